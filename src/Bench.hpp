@@ -0,0 +1,70 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+
+/**
+ * pieces of the --bench sweep that don't touch the cave:
+ * the process layouts to try and the statistics of the repeated trials
+ */
+
+struct BenchLayout
+{
+	int y_threads, x_threads;
+};
+
+// every y_threads x x_threads grid of 1 to max_procs processes, fewer processes first
+inline std::vector<BenchLayout> bench_layouts(int max_procs) {
+	std::vector<BenchLayout> layouts;
+	for(int procs = 1; procs <= max_procs; procs++) {
+		for(int y_threads = 1; y_threads <= procs; y_threads++) {
+			if(procs % y_threads == 0)
+				layouts.push_back({ y_threads, procs / y_threads });
+		}
+	}
+	return layouts;
+}
+
+// two sided 95% quantile of the student t distribution
+inline double student_t_95(int degrees_of_freedom) {
+	static const double table[30] = {
+		12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+		2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+		2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+	};
+	if(degrees_of_freedom < 1)
+		return 0;
+	if(degrees_of_freedom <= 30)
+		return table[degrees_of_freedom - 1];
+	// close enough past 30
+	return 1.960 + 2.4 / degrees_of_freedom;
+}
+
+struct BenchSummary
+{
+	double mean, stddev, min;
+	// 95% confidence interval of the mean
+	double ci_low, ci_high;
+};
+
+inline BenchSummary summarize_bench(const std::vector<double>& samples) {
+	BenchSummary summary = { 0, 0, 0, 0, 0 };
+	int n = samples.size();
+	if(n == 0)
+		return summary;
+
+	for(double sample : samples)
+		summary.mean += sample;
+	summary.mean /= n;
+	for(double sample : samples)
+		summary.stddev += (sample - summary.mean) * (sample - summary.mean);
+	summary.stddev = n > 1 ? std::sqrt(summary.stddev / (n - 1)) : 0;
+	summary.min = *std::min_element(samples.begin(), samples.end());
+
+	double half_width = student_t_95(n - 1) * summary.stddev / std::sqrt((double)n);
+	summary.ci_low = summary.mean - half_width;
+	summary.ci_high = summary.mean + half_width;
+	return summary;
+}
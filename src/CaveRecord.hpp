@@ -0,0 +1,319 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+
+/**
+ * recording of many generations of a cave in a single file.
+ * the file starts with a CaveRecordHeader, then every frame is a CaveRecordFrame followed by its payload:
+ * every keyframe_interval-th frame (the first one included) is a keyframe, holding the grid bit-packed like pbm,
+ * the others hold the xor of the grid with the previous frame, bit-packed and run-length encoded.
+ * after the last frame comes the index, the file offset of every keyframe, so a frame is at most
+ * keyframe_interval - 1 deltas away from the nearest keyframe.
+ */
+#define CAVE_RECORD_MAGIC "CAVEREC\0"
+#define CAVE_RECORD_VERSION 1
+
+struct CaveRecordHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t rows;
+	uint32_t cols;
+	uint32_t keyframe_interval;
+	// both 0 until the recording is closed
+	uint32_t frame_count;
+	uint32_t reserved;
+	uint64_t index_offset;
+};
+
+struct CaveRecordFrame
+{
+	int32_t generation;
+	// bytes of payload after this
+	uint32_t size;
+};
+
+
+// grid of 0 and 1 to 8 cells per byte, the most significant bit first
+inline void cave_record_pack(const uint8_t* cells, int rows, int cols, uint8_t* packed) {
+	int row_bytes = (cols + 7) / 8;
+	for(int i = 0; i < rows; i++) {
+		const uint8_t* row = &cells[i * cols];
+		uint8_t* packed_row = &packed[i * row_bytes];
+		for(int b = 0; b < row_bytes; b++) {
+			uint8_t byte = 0;
+			int bits = std::min(8, cols - b * 8);
+			for(int bit = 0; bit < bits; bit++)
+				byte |= (row[b * 8 + bit] & 1) << (7 - bit);
+			packed_row[b] = byte;
+		}
+	}
+}
+
+inline void cave_record_unpack(const uint8_t* packed, int rows, int cols, uint8_t* cells) {
+	int row_bytes = (cols + 7) / 8;
+	for(int i = 0; i < rows; i++) {
+		const uint8_t* packed_row = &packed[i * row_bytes];
+		uint8_t* row = &cells[i * cols];
+		for(int j = 0; j < cols; j++)
+			row[j] = (packed_row[j / 8] >> (7 - j % 8)) & 1;
+	}
+}
+
+inline void cave_record_put_varint(std::string& out, uint32_t value) {
+	while(value >= 0x80) {
+		out += (char)(value | 0x80);
+		value >>= 7;
+	}
+	out += (char)value;
+}
+
+inline bool cave_record_get_varint(const uint8_t* bytes, size_t size, size_t& pos, uint32_t& value) {
+	value = 0;
+	for(int shift = 0; shift < 35 && pos < size; shift += 7) {
+		uint8_t byte = bytes[pos++];
+		value |= (uint32_t)(byte & 0x7f) << shift;
+		if(!(byte & 0x80))
+			return true;
+	}
+	return false;
+}
+
+/**
+ * xor of current and previous as pairs of runs: a count of unchanged bytes, then a count of changed bytes and the bytes.
+ * single unchanged bytes are kept in the changed run, a pair of runs costs more
+ */
+inline void cave_record_encode_delta(const uint8_t* current, const uint8_t* previous, size_t size, std::string& out) {
+	size_t pos = 0;
+	while(pos < size) {
+		size_t same_start = pos;
+		while(pos < size && current[pos] == previous[pos]) pos++;
+		cave_record_put_varint(out, pos - same_start);
+
+		size_t changed_start = pos;
+		while(pos < size && (current[pos] != previous[pos] || (pos + 1 < size && current[pos + 1] != previous[pos + 1]))) pos++;
+		cave_record_put_varint(out, pos - changed_start);
+		for(size_t i = changed_start; i < pos; i++)
+			out += (char)(current[i] ^ previous[i]);
+	}
+}
+
+// applies a delta to the previous packed grid, false if the delta is corrupt
+inline bool cave_record_apply_delta(const uint8_t* delta, size_t delta_size, uint8_t* packed, size_t size) {
+	size_t pos = 0;
+	size_t packed_pos = 0;
+	while(pos < delta_size) {
+		uint32_t same, changed;
+		if(!cave_record_get_varint(delta, delta_size, pos, same) || !cave_record_get_varint(delta, delta_size, pos, changed))
+			return false;
+		packed_pos += same;
+		if(packed_pos + changed > size || pos + changed > delta_size)
+			return false;
+		for(uint32_t i = 0; i < changed; i++)
+			packed[packed_pos++] ^= delta[pos++];
+	}
+	return true;
+}
+
+
+class CaveRecordWriter
+{
+public:
+	CaveRecordWriter() {}
+	~CaveRecordWriter() { close(); }
+
+	CaveRecordWriter(const CaveRecordWriter&) = delete;
+	CaveRecordWriter& operator=(const CaveRecordWriter&) = delete;
+
+	bool open(const std::string& path, int rows, int cols, int keyframe_interval) {
+		file.open(path, std::ios::binary);
+		if(!file.is_open())
+			return false;
+
+		std::memcpy(header.magic, CAVE_RECORD_MAGIC, sizeof(header.magic));
+		header.version = CAVE_RECORD_VERSION;
+		header.rows = rows;
+		header.cols = cols;
+		header.keyframe_interval = keyframe_interval;
+		header.frame_count = 0;
+		header.reserved = 0;
+		header.index_offset = 0;
+		file.write((const char*)&header, sizeof(header));
+
+		packed_size = (size_t)rows * ((cols + 7) / 8);
+		packed = new uint8_t[packed_size];
+		previous = new uint8_t[packed_size];
+		frame_count = 0;
+		return file.good();
+	}
+
+	// cells is a rows x cols row-major grid of 0 (floor) and 1 (wall)
+	bool add_frame(const uint8_t* cells, int generation) {
+		cave_record_pack(cells, header.rows, header.cols, packed);
+
+		payload.clear();
+		if(frame_count % header.keyframe_interval == 0) {
+			keyframe_offsets.push_back(file.tellp());
+			payload.append((const char*)packed, packed_size);
+		}
+		else cave_record_encode_delta(packed, previous, packed_size, payload);
+		std::swap(packed, previous);
+
+		CaveRecordFrame frame = { generation, (uint32_t)payload.size() };
+		file.write((const char*)&frame, sizeof(frame));
+		file.write(payload.data(), payload.size());
+		frame_count++;
+		return file.good();
+	}
+
+	// writes the index, a recording that's never closed can still be read from the start
+	bool close() {
+		if(!file.is_open())
+			return true;
+
+		header.index_offset = file.tellp();
+		header.frame_count = frame_count;
+		file.write((const char*)keyframe_offsets.data(), keyframe_offsets.size() * sizeof(uint64_t));
+		file.seekp(0);
+		file.write((const char*)&header, sizeof(header));
+		bool is_good = file.good();
+		file.close();
+
+		delete[] packed;
+		delete[] previous;
+		packed = previous = nullptr;
+		keyframe_offsets.clear();
+		return is_good;
+	}
+
+private:
+	std::ofstream file;
+	CaveRecordHeader header;
+	size_t packed_size = 0;
+	uint8_t* packed = nullptr;
+	uint8_t* previous = nullptr;
+	uint32_t frame_count = 0;
+	std::string payload;
+	std::vector<uint64_t> keyframe_offsets;
+};
+
+
+class CaveRecordReader
+{
+public:
+	CaveRecordReader() {}
+	~CaveRecordReader() { delete[] packed; }
+
+	CaveRecordReader(const CaveRecordReader&) = delete;
+	CaveRecordReader& operator=(const CaveRecordReader&) = delete;
+
+	bool open(const std::string& path) {
+		file.open(path, std::ios::binary);
+		if(!file.is_open())
+			return false;
+		if(!file.read((char*)&header, sizeof(header)))
+			return false;
+		if(std::memcmp(header.magic, CAVE_RECORD_MAGIC, sizeof(header.magic)) != 0 || header.version != CAVE_RECORD_VERSION
+			|| header.rows == 0 || header.cols == 0 || header.keyframe_interval == 0)
+			return false;
+
+		packed_size = (size_t)header.rows * ((header.cols + 7) / 8);
+		packed = new uint8_t[packed_size];
+
+		if(header.index_offset != 0) {
+			keyframe_offsets.resize((header.frame_count + header.keyframe_interval - 1) / header.keyframe_interval);
+			file.seekg(header.index_offset);
+			file.read((char*)keyframe_offsets.data(), keyframe_offsets.size() * sizeof(uint64_t));
+			frame_count = header.frame_count;
+		}
+		// no index, or a copy cut short before it
+		if(header.index_offset == 0 || !file.good()) {
+			file.clear();
+			keyframe_offsets.clear();
+			scan_frames();
+		}
+		return file.good() && frame_count > 0;
+	}
+
+	int rows() const { return header.rows; }
+	int cols() const { return header.cols; }
+	int frames() const { return frame_count; }
+
+	/**
+	 * the grid of a frame, as 0 and 1 in a rows x cols row-major grid.
+	 * the next frame is a single delta away, any other one is decoded from the keyframe before it
+	 */
+	bool read_frame(int frame, uint8_t* cells, int& generation) {
+		if(frame < 0 || frame >= frame_count)
+			return false;
+
+		if(frame != current_frame + 1 || current_frame < 0) {
+			int keyframe = frame / header.keyframe_interval;
+			file.clear();
+			file.seekg(keyframe_offsets[keyframe]);
+			current_frame = keyframe * header.keyframe_interval - 1;
+		}
+		while(current_frame < frame) {
+			if(!read_next_frame(generation))
+				return false;
+		}
+
+		cave_record_unpack(packed, header.rows, header.cols, cells);
+		return true;
+	}
+
+private:
+	std::ifstream file;
+	CaveRecordHeader header;
+	size_t packed_size = 0;
+	uint8_t* packed = nullptr;
+	int frame_count = 0;
+	int current_frame = -1;
+	std::string payload;
+	std::vector<uint64_t> keyframe_offsets;
+
+	bool read_next_frame(int& generation) {
+		CaveRecordFrame frame;
+		if(!file.read((char*)&frame, sizeof(frame)))
+			return false;
+		payload.resize(frame.size);
+		if(!file.read(&payload[0], frame.size))
+			return false;
+
+		current_frame++;
+		generation = frame.generation;
+		if(current_frame % header.keyframe_interval == 0) {
+			if(frame.size != packed_size)
+				return false;
+			std::memcpy(packed, payload.data(), packed_size);
+			return true;
+		}
+		return cave_record_apply_delta((const uint8_t*)payload.data(), payload.size(), packed, packed_size);
+	}
+
+	// a recording cut short has no index, it's rebuilt from the frames that made it to the file
+	void scan_frames() {
+		file.seekg(0, std::ios::end);
+		std::streamoff file_size = file.tellg();
+		std::streamoff offset = sizeof(header);
+		frame_count = 0;
+		CaveRecordFrame frame;
+		while(offset + (std::streamoff)sizeof(frame) <= file_size) {
+			file.seekg(offset);
+			// a frame with a truncated payload doesn't count
+			if(!file.read((char*)&frame, sizeof(frame)) || offset + (std::streamoff)sizeof(frame) + frame.size > file_size)
+				break;
+			if(frame_count % header.keyframe_interval == 0)
+				keyframe_offsets.push_back(offset);
+			frame_count++;
+			offset += sizeof(frame) + frame.size;
+		}
+		file.clear();
+	}
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <mpi.h>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "GridIO.hpp"
+
+
+/**
+ * a checkpoint file is this header followed by a whole grid file (raw or pbm),
+ * so a checkpoint can be restarted with any decomposition.
+ * the header is written last: a checkpoint cut short has no valid header and is skipped.
+ */
+#define CHECKPOINT_MAGIC "CAVECKPT"
+#define CHECKPOINT_VERSION 1
+
+struct CheckpointHeader
+{
+	char magic[8];
+	uint32_t version;
+	// the grid is bit-packed (pbm) instead of raw
+	uint32_t is_compressed;
+	// generations already run
+	int64_t generation;
+	// a restart must run with the same settings
+	uint64_t config_hash;
+};
+
+#define CHECKPOINT_HEADER_SIZE ((int)sizeof(CheckpointHeader))
+
+// the two checkpoint files are written in turns, so the older one survives a crash during a write
+inline std::string checkpoint_file_path(const std::string& path, int64_t generation, int interval) {
+	return path + "." + std::to_string((generation / interval) % 2);
+}
+
+// FNV-1a of the settings that change how the cave evolves
+inline uint64_t checkpoint_config_hash(const int* settings, int count) {
+	uint64_t hash = 14695981039346656037ULL;
+	const uint8_t* bytes = (const uint8_t*)settings;
+	for(size_t i = 0; i < count * sizeof(int); i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/**
+ * COLLECTIVE
+ * every process of comm writes its own tile, then the first one writes the header
+ * once the grid is safely in the file.
+ * returns MPI_SUCCESS if the checkpoint was written.
+ */
+inline int write_checkpoint_file(MPI_Comm comm, const std::string& path, int64_t generation, uint64_t config_hash, bool is_compressed,
+	const GridTile& tile, const uint8_t* cells, int stride) {
+	MPI_File file;
+	int err = MPI_File_open(comm, path.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file);
+	if(err != MPI_SUCCESS)
+		return err;
+	// drops the old header too, until the new one is written the file isn't a checkpoint
+	MPI_File_set_size(file, 0);
+
+	int rank;
+	MPI_Comm_rank(comm, &rank);
+	err = write_grid_at(file, CHECKPOINT_HEADER_SIZE, rank == 0, is_compressed ? GRID_PBM : GRID_RAW, tile, cells, stride);
+	// the header is written only if every tile made it
+	int is_failed = err != MPI_SUCCESS;
+	MPI_Allreduce(MPI_IN_PLACE, &is_failed, 1, MPI_INT, MPI_LOR, comm);
+	MPI_File_sync(file);
+
+	if(rank == 0 && !is_failed) {
+		CheckpointHeader header;
+		std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+		header.version = CHECKPOINT_VERSION;
+		header.is_compressed = is_compressed;
+		header.generation = generation;
+		header.config_hash = config_hash;
+		is_failed = MPI_File_write_at(file, 0, &header, CHECKPOINT_HEADER_SIZE, MPI_BYTE, MPI_STATUS_IGNORE) != MPI_SUCCESS;
+	}
+	MPI_File_sync(file);
+	MPI_Bcast(&is_failed, 1, MPI_INT, 0, comm);
+
+	MPI_File_close(&file);
+	return is_failed ? MPI_ERR_IO : MPI_SUCCESS;
+}
+
+/**
+ * COLLECTIVE
+ * the first process of comm reads the checkpoint header and shares it with the others.
+ * returns false if there's no complete checkpoint at path.
+ */
+inline bool read_checkpoint_header(MPI_Comm comm, const std::string& path, CheckpointHeader& header) {
+	MPI_File file;
+	if(MPI_File_open(comm, path.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS)
+		return false;
+
+	int rank;
+	MPI_Comm_rank(comm, &rank);
+	std::memset(&header, 0, CHECKPOINT_HEADER_SIZE);
+	if(rank == 0)
+		MPI_File_read_at(file, 0, &header, CHECKPOINT_HEADER_SIZE, MPI_BYTE, MPI_STATUS_IGNORE);
+	MPI_Bcast(&header, CHECKPOINT_HEADER_SIZE, MPI_BYTE, 0, comm);
+	MPI_File_close(&file);
+
+	return std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) == 0 && header.version == CHECKPOINT_VERSION;
+}
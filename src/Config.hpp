@@ -4,6 +4,9 @@
 #include <fstream> //ifstream
 #include <iostream> //cout
 #include <assert.h>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "json.hpp"
 using json = nlohmann::json;
@@ -54,9 +57,34 @@ struct Config
 	//GRAPHIC AND PARALLEL ONLY
 	bool draw_threads_grid = true;
 
+	// GRAPHIC AND PARALLEL ONLY
+	// run with x_threads * y_threads + 1 processes,
+	// the last one doesn't compute and only shows the grid
+	bool render_rank = false;
+
 	// GRAPHIC ONLY
 	int max_frame_rate = 60;
 
+	// GRAPHIC ONLY
+	// generations run between two frames
+	// 0 means as many as fit in the time between two frames
+	int generations_per_frame = 0;
+
+	// GRAPHIC ONLY
+	// side of the square block of cells shown as a single displayed cell
+	// 0 means pick the smallest block that fits the graphic size limit
+	int lod = 0;
+
+	// GRAPHIC ONLY
+	// how a block is shown when lod > 1:
+	// "majority" shows the block as wall or floor, "density" blends the two colors
+	std::string lod_mode = "density";
+
+	// GRAPHIC ONLY
+	// MB of memory for the frames already shown, they can be shown again while paused
+	// 0 keeps no history
+	int history_memory = 256;
+
 	// GRAPHIC ONLY
 	rgb wall_color{ 0, 0, 0 };
 
@@ -68,6 +96,87 @@ struct Config
 
 	std::string results_file_path = "";
 
+	// most generations the latency percentiles are taken from, past this the oldest are dropped
+	// every phase keeps a buffer of this many doubles on every process
+	int latency_samples = 1 << 16;
+
+	// chrome trace of the halo exchange, update, gather and draw of every process, written at exit
+	// nothing is traced if empty
+	std::string trace_file_path = "";
+
+	// cycles, instructions, cache and branch misses of update, halo and draw, with perf_event_open
+	// counters the kernel doesn't allow are left out
+	bool perf_counters = false;
+
+	// messages, bytes and blocked time per peer and per direction, counted by the PMPI wrappers
+	// and written here when MPI is finalized, nothing is counted if empty
+	std::string mpi_profile_file_path = "";
+
+	// PARALLEL ONLY
+	// x_threads and y_threads are picked by timing a few generations of every layout of the processes
+	bool auto_decompose = false;
+	int auto_decompose_generations = 10;
+	// layouts already picked, by host, grid size, radius and processes, so they're timed only once
+	std::string decompose_cache_path = "./config/decompose_cache.json";
+
+	// BENCHMARK ONLY
+	// --bench times a sweep of grids, radii and process layouts in one MPI job instead of running the cave
+	bool bench = false;
+	// "strong": every layout runs the same grid, "weak": the grid grows so every process keeps the same tile
+	std::string bench_mode = "strong";
+	// {cols, rows} of the grids, the tile of a single process in weak mode. cols and rows if empty
+	std::vector<std::pair<int, int>> bench_sizes;
+	// neighbour_radius if empty
+	std::vector<int> bench_radii;
+	// only the halo exchange runs, no cell is updated, to time the exchange on its own
+	bool bench_halo_only = false;
+	// layouts use up to this many processes, all of them if 0
+	int bench_max_procs = 0;
+	// generations run before the trials of every case
+	int bench_warmup_generations = 5;
+	int bench_trials = 10;
+	int bench_generations = 20; // in every trial
+	// one row per trial
+	std::string bench_file_path = "./bench.csv";
+
+	// raw, pgm or pbm file the first generation is loaded from, its size replaces cols and rows
+	// the grid is filled randomly if empty
+	std::string load_file_path = "";
+
+	// the last generation is saved here, nothing is saved if empty
+	std::string save_file_path = "";
+
+	// "raw", "pgm", "pbm" (bit-packed) or "png" (deflated in parallel, wall_color and floor_color as palette)
+	std::string save_format = "pgm";
+
+	// the generations are recorded here, a gif file or a folder of pgm/png frames
+	// nothing is recorded if empty
+	std::string record_path = "";
+
+	// "gif", "cave", "pgm" or "png"
+	// cave stores the first frame bit-packed and the others as deltas, it's shown with -play
+	std::string record_format = "gif";
+
+	// CAVE RECORDING ONLY
+	// frames between two keyframes, playback seeks to the keyframe before a frame and decodes from there
+	int record_keyframe_interval = 100;
+
+	// one generation every record_interval is recorded
+	int record_interval = 1;
+
+	// generations between two checkpoints
+	// 0 means no checkpoints
+	int checkpoint_interval = 0;
+
+	// checkpoints are written in turns to checkpoint_file_path.0 and checkpoint_file_path.1
+	std::string checkpoint_file_path = "./checkpoint";
+
+	// bit-pack the grid in checkpoints, 8 times smaller
+	bool checkpoint_compress = false;
+
+	// resume from the newest checkpoint instead of starting a new cave
+	bool restart = false;
+
 
 	// Config() : Config("./config/default.cfg") {}
 
@@ -84,7 +193,11 @@ struct Config
 			}
 			else {
 				std::cout << "Exiting..." << std::endl;
-				MPI_Abort(MPI_COMM_WORLD, 1);
+				// playback reads the config before MPI is initialized
+				int is_mpi_initialized;
+				MPI_Initialized(&is_mpi_initialized);
+				if(is_mpi_initialized)
+					MPI_Abort(MPI_COMM_WORLD, 1);
 				exit(1);
 			}
 		}
@@ -112,6 +225,11 @@ struct Config
 
 		if(jsonConfig.contains("draw_edges")) draw_edges = jsonConfig["draw_edges"];
 		if(jsonConfig.contains("max_frame_rate")) max_frame_rate = jsonConfig["max_frame_rate"];
+		if(jsonConfig.contains("generations_per_frame")) generations_per_frame = jsonConfig["generations_per_frame"];
+
+		if(jsonConfig.contains("lod")) lod = jsonConfig["lod"];
+		if(jsonConfig.contains("lod_mode")) lod_mode = jsonConfig["lod_mode"];
+		if(jsonConfig.contains("history_memory")) history_memory = jsonConfig["history_memory"];
 
 		if(jsonConfig.contains("initial_fill_perc")) initial_fill_perc = jsonConfig["initial_fill_perc"];
 
@@ -119,6 +237,7 @@ struct Config
 		if(jsonConfig.contains("roughness")) roughness = jsonConfig["roughness"];
 
 		if(jsonConfig.contains("draw_threads_grid")) draw_threads_grid = jsonConfig["draw_threads_grid"];
+		if(jsonConfig.contains("render_rank")) render_rank = jsonConfig["render_rank"];
 
 		if(jsonConfig.contains("wall_color")) {
 			wall_color.r = jsonConfig["wall_color"][0];
@@ -139,6 +258,38 @@ struct Config
 		}
 
 		if(jsonConfig.contains("results_file_path")) results_file_path = jsonConfig["results_file_path"];
+		if(jsonConfig.contains("latency_samples")) latency_samples = jsonConfig["latency_samples"];
+		if(jsonConfig.contains("trace_file_path")) trace_file_path = jsonConfig["trace_file_path"];
+		if(jsonConfig.contains("perf_counters")) perf_counters = jsonConfig["perf_counters"];
+		if(jsonConfig.contains("mpi_profile_file_path")) mpi_profile_file_path = jsonConfig["mpi_profile_file_path"];
+
+		if(jsonConfig.contains("auto_decompose")) auto_decompose = jsonConfig["auto_decompose"];
+		if(jsonConfig.contains("auto_decompose_generations")) auto_decompose_generations = jsonConfig["auto_decompose_generations"];
+		if(jsonConfig.contains("decompose_cache_path")) decompose_cache_path = jsonConfig["decompose_cache_path"];
+
+		if(jsonConfig.contains("bench_mode")) bench_mode = jsonConfig["bench_mode"];
+		if(jsonConfig.contains("bench_sizes")) bench_sizes = jsonConfig["bench_sizes"].get<std::vector<std::pair<int, int>>>();
+		if(jsonConfig.contains("bench_radii")) bench_radii = jsonConfig["bench_radii"].get<std::vector<int>>();
+		if(jsonConfig.contains("bench_halo_only")) bench_halo_only = jsonConfig["bench_halo_only"];
+		if(jsonConfig.contains("bench_max_procs")) bench_max_procs = jsonConfig["bench_max_procs"];
+		if(jsonConfig.contains("bench_warmup_generations")) bench_warmup_generations = jsonConfig["bench_warmup_generations"];
+		if(jsonConfig.contains("bench_trials")) bench_trials = jsonConfig["bench_trials"];
+		if(jsonConfig.contains("bench_generations")) bench_generations = jsonConfig["bench_generations"];
+		if(jsonConfig.contains("bench_file_path")) bench_file_path = jsonConfig["bench_file_path"];
+
+		if(jsonConfig.contains("load_file_path")) load_file_path = jsonConfig["load_file_path"];
+		if(jsonConfig.contains("save_file_path")) save_file_path = jsonConfig["save_file_path"];
+		if(jsonConfig.contains("save_format")) save_format = jsonConfig["save_format"];
+
+		if(jsonConfig.contains("record_path")) record_path = jsonConfig["record_path"];
+		if(jsonConfig.contains("record_format")) record_format = jsonConfig["record_format"];
+		if(jsonConfig.contains("record_interval")) record_interval = jsonConfig["record_interval"];
+		if(jsonConfig.contains("record_keyframe_interval")) record_keyframe_interval = jsonConfig["record_keyframe_interval"];
+
+		if(jsonConfig.contains("checkpoint_interval")) checkpoint_interval = jsonConfig["checkpoint_interval"];
+		if(jsonConfig.contains("checkpoint_file_path")) checkpoint_file_path = jsonConfig["checkpoint_file_path"];
+		if(jsonConfig.contains("checkpoint_compress")) checkpoint_compress = jsonConfig["checkpoint_compress"];
+		if(jsonConfig.contains("restart")) restart = jsonConfig["restart"];
 
 	}
 };
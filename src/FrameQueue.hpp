@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+
+/**
+ * lock-free queue between exactly one producer thread and one consumer thread.
+ * it never allocates after construction, so it's meant to pass around pointers
+ * to buffers that get reused.
+ */
+template <typename T>
+class FrameQueue
+{
+public:
+	FrameQueue(size_t capacity) : size(capacity + 1), items(new T[capacity + 1]) {}
+	~FrameQueue() { delete[] items; }
+
+	FrameQueue(const FrameQueue&) = delete;
+	FrameQueue& operator=(const FrameQueue&) = delete;
+
+	// PRODUCER ONLY
+	// returns false if the queue is full
+	bool push(const T& item) {
+		size_t tail = write_idx.load(std::memory_order_relaxed);
+		size_t next = (tail + 1) % size;
+		if(next == read_idx.load(std::memory_order_acquire))
+			return false;
+
+		items[tail] = item;
+		write_idx.store(next, std::memory_order_release);
+		return true;
+	}
+
+	// CONSUMER ONLY
+	// returns false if the queue is empty
+	bool pop(T& item) {
+		size_t head = read_idx.load(std::memory_order_relaxed);
+		if(head == write_idx.load(std::memory_order_acquire))
+			return false;
+
+		item = items[head];
+		read_idx.store((head + 1) % size, std::memory_order_release);
+		return true;
+	}
+
+private:
+	// one slot is always left empty to tell a full queue from an empty one
+	const size_t size;
+	T* items;
+
+	// on separate cache lines, each is written by a single thread
+	alignas(64) std::atomic<size_t> write_idx{ 0 };
+	alignas(64) std::atomic<size_t> read_idx{ 0 };
+};
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include "Config.hpp"
+
+
+/**
+ * animated gif written one frame at a time, nothing but the previous frame is kept in memory.
+ * floor is color 0 and wall color 1, each frame only covers the rectangle that changed.
+ */
+class GifWriter
+{
+public:
+	GifWriter() {}
+	~GifWriter() { close(); }
+
+	GifWriter(const GifWriter&) = delete;
+	GifWriter& operator=(const GifWriter&) = delete;
+
+	// delay is how long each frame is shown, in hundredths of a second
+	bool open(const std::string& path, int width, int height, rgb floor_color, rgb wall_color, int delay) {
+		file.open(path, std::ios::binary);
+		if(!file.is_open())
+			return false;
+		this->width = width;
+		this->height = height;
+		this->delay = delay;
+		previous = new uint8_t[width * height];
+		is_first_frame = true;
+
+		file.write("GIF89a", 6);
+		put_u16(width);
+		put_u16(height);
+		// global color table of 2 colors
+		put_byte(0x80);
+		put_byte(0);
+		put_byte(0);
+		const uint8_t colors[6] = {
+			(uint8_t)floor_color.r, (uint8_t)floor_color.g, (uint8_t)floor_color.b,
+			(uint8_t)wall_color.r, (uint8_t)wall_color.g, (uint8_t)wall_color.b
+		};
+		file.write((const char*)colors, 6);
+
+		// loops forever
+		file.write("\x21\xff\x0bNETSCAPE2.0\x03\x01\x00\x00\x00", 19);
+		return file.good();
+	}
+
+	// cells is a width x height row-major grid of 0 (floor) and 1 (wall)
+	void add_frame(const uint8_t* cells) {
+		int left = 0, top = 0, right = width - 1, bottom = height - 1;
+		if(!is_first_frame && !get_changed_rect(cells, left, top, right, bottom)) {
+			// nothing changed, a single pixel keeps the timing
+			left = right = top = bottom = 0;
+		}
+		is_first_frame = false;
+		std::memcpy(previous, cells, width * height);
+
+		// graphic control: keep the previous frame under this one
+		file.write("\x21\xf9\x04\x04", 4);
+		put_u16(delay);
+		put_byte(0);
+		put_byte(0);
+
+		put_byte(0x2c);
+		put_u16(left);
+		put_u16(top);
+		put_u16(right - left + 1);
+		put_u16(bottom - top + 1);
+		put_byte(0);
+
+		compress(cells, left, top, right, bottom);
+	}
+
+	void close() {
+		if(!file.is_open())
+			return;
+		put_byte(0x3b);
+		file.close();
+		delete[] previous;
+		previous = nullptr;
+	}
+
+	bool good() const { return file.good(); }
+
+private:
+	// smallest code size gif allows, 2 bits per pixel
+	static const int MIN_CODE_SIZE = 2;
+	static const int CLEAR_CODE = 1 << MIN_CODE_SIZE;
+	static const int END_CODE = CLEAR_CODE + 1;
+	static const int MAX_CODE = 4095;
+
+	std::ofstream file;
+	int width = 0;
+	int height = 0;
+	int delay = 0;
+	uint8_t* previous = nullptr;
+	bool is_first_frame = true;
+
+	// lzw state, codes made of a prefix code followed by a 0 or 1 pixel
+	uint16_t children[(MAX_CODE + 1) * 2];
+	int next_code;
+	int code_size;
+	int max_code_size_code;
+
+	// bits waiting to be written, and the data sub-block they go in
+	uint32_t bit_buffer;
+	int bit_count;
+	uint8_t block[255];
+	int block_size;
+
+	void put_byte(uint8_t byte) { file.put((char)byte); }
+	void put_u16(int value) {
+		put_byte(value & 0xff);
+		put_byte((value >> 8) & 0xff);
+	}
+
+	bool get_changed_rect(const uint8_t* cells, int& left, int& top, int& right, int& bottom) {
+		top = 0;
+		while(top < height && std::memcmp(&cells[top * width], &previous[top * width], width) == 0) top++;
+		if(top == height)
+			return false;
+		bottom = height - 1;
+		while(std::memcmp(&cells[bottom * width], &previous[bottom * width], width) == 0) bottom--;
+
+		left = width - 1;
+		right = 0;
+		for(int i = top; i <= bottom; i++) {
+			const uint8_t* row = &cells[i * width];
+			const uint8_t* previous_row = &previous[i * width];
+			int j = 0;
+			while(j < left && row[j] == previous_row[j]) j++;
+			left = j;
+			j = width - 1;
+			while(j > right && row[j] == previous_row[j]) j--;
+			right = j;
+		}
+		return true;
+	}
+
+	void reset_codes() {
+		std::memset(children, 0, sizeof(children));
+		next_code = END_CODE + 1;
+		code_size = MIN_CODE_SIZE + 1;
+		max_code_size_code = 1 << code_size;
+	}
+
+	void flush_block() {
+		if(block_size == 0)
+			return;
+		put_byte(block_size);
+		file.write((const char*)block, block_size);
+		block_size = 0;
+	}
+
+	void output(int code) {
+		bit_buffer |= (uint32_t)code << bit_count;
+		bit_count += code_size;
+		while(bit_count >= 8) {
+			block[block_size++] = bit_buffer & 0xff;
+			bit_buffer >>= 8;
+			bit_count -= 8;
+			if(block_size == 255)
+				flush_block();
+		}
+		// the decoder adds codes one step later, so the size grows once the next code doesn't fit
+		if(next_code >= max_code_size_code && code_size < 12)
+			max_code_size_code = 1 << ++code_size;
+	}
+
+	void compress(const uint8_t* cells, int left, int top, int right, int bottom) {
+		put_byte(MIN_CODE_SIZE);
+		bit_buffer = 0;
+		bit_count = 0;
+		block_size = 0;
+		reset_codes();
+		output(CLEAR_CODE);
+
+		int code = cells[top * width + left];
+		bool is_first_pixel = true;
+		for(int i = top; i <= bottom; i++) {
+			const uint8_t* row = &cells[i * width];
+			for(int j = left; j <= right; j++) {
+				if(is_first_pixel) {
+					is_first_pixel = false;
+					continue;
+				}
+				int pixel = row[j];
+				uint16_t child = children[code * 2 + pixel];
+				if(child != 0) {
+					code = child;
+					continue;
+				}
+
+				output(code);
+				if(next_code >= MAX_CODE) {
+					output(CLEAR_CODE);
+					reset_codes();
+				}
+				else children[code * 2 + pixel] = next_code++;
+				code = pixel;
+			}
+		}
+		output(code);
+		output(END_CODE);
+
+		if(bit_count > 0)
+			block[block_size++] = bit_buffer & 0xff;
+		flush_block();
+		put_byte(0);
+	}
+};
@@ -0,0 +1,379 @@
+#pragma once
+
+#include <mpi.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+
+/**
+ * formats a cave can be saved in, each one is a small header followed by the rows of the grid.
+ * RAW: "CAVE", version, rows and cols as 32 bit integers, then one byte per cell (1 is wall)
+ * PGM: binary greymap, walls are black (0) and floors white (255)
+ * PBM: binary bitmap, 8 cells per byte, walls are black (1), rows padded to a whole byte
+ */
+enum GridFormat { GRID_RAW, GRID_PGM, GRID_PBM };
+
+#define GRID_RAW_MAGIC "CAVE"
+#define GRID_RAW_VERSION 1
+#define GRID_RAW_HEADER_SIZE 16
+
+// longest header read when loading, pgm comments must fit in it
+#define GRID_MAX_HEADER_SIZE 1024
+
+// read_grid_file errors that aren't MPI ones, MPI error codes are never negative
+// the file is shorter than its header says
+#define GRID_ERR_TRUNCATED -1
+// a raw cell isn't 0 or 1
+#define GRID_ERR_BAD_CELL -2
+
+// where a process tile sits in the whole grid
+struct GridTile
+{
+	// whole grid
+	int rows;
+	int cols;
+
+	// first cell of the tile in the whole grid
+	int first_row;
+	int first_col;
+
+	int tile_rows;
+	int tile_cols;
+};
+
+
+inline bool grid_format_from_name(const std::string& name, GridFormat& format) {
+	if(name == "raw") format = GRID_RAW;
+	else if(name == "pgm") format = GRID_PGM;
+	else if(name == "pbm") format = GRID_PBM;
+	else return false;
+	return true;
+}
+
+inline std::string grid_header(GridFormat format, int rows, int cols) {
+	if(format == GRID_PGM)
+		return "P5\n" + std::to_string(cols) + " " + std::to_string(rows) + "\n255\n";
+	if(format == GRID_PBM)
+		return "P4\n" + std::to_string(cols) + " " + std::to_string(rows) + "\n";
+
+	uint32_t fields[3] = { GRID_RAW_VERSION, (uint32_t)rows, (uint32_t)cols };
+	return std::string(GRID_RAW_MAGIC, 4) + std::string((const char*)fields, sizeof(fields));
+}
+
+// bytes a grid row takes in the file, and the bytes of it that belong to the tile
+inline void grid_row_bytes(GridFormat format, const GridTile& tile, int& row_bytes, int& first_byte, int& tile_bytes) {
+	if(format != GRID_PBM) {
+		row_bytes = tile.cols;
+		first_byte = tile.first_col;
+		tile_bytes = tile.tile_cols;
+		return;
+	}
+
+	row_bytes = (tile.cols + 7) / 8;
+	first_byte = tile.first_col / 8;
+	// only the last tile of a row owns the padding
+	int last_col = tile.first_col + tile.tile_cols;
+	tile_bytes = (last_col == tile.cols ? row_bytes * 8 : last_col) / 8 - first_byte;
+}
+
+// PBM packs 8 cells in a byte, so a byte can't be split between two tiles
+inline bool grid_tile_fits(GridFormat format, const GridTile& tile) {
+	if(format != GRID_PBM)
+		return true;
+	return tile.first_col % 8 == 0 && ((tile.first_col + tile.tile_cols) % 8 == 0 || tile.first_col + tile.tile_cols == tile.cols);
+}
+
+// turns the tile cells into the bytes written to the file
+inline void grid_pack_tile(GridFormat format, const GridTile& tile, const uint8_t* cells, int stride, uint8_t* packed, int tile_bytes) {
+	for(int i = 0; i < tile.tile_rows; i++) {
+		const uint8_t* row = &cells[i * stride];
+		uint8_t* packed_row = &packed[i * tile_bytes];
+
+		if(format == GRID_PGM) {
+			for(int j = 0; j < tile.tile_cols; j++)
+				packed_row[j] = row[j] ? 0 : 255;
+			continue;
+		}
+
+		for(int b = 0; b < tile_bytes; b++) {
+			uint8_t byte = 0;
+			for(int bit = 0; bit < 8; bit++) {
+				int j = b * 8 + bit;
+				if(j < tile.tile_cols && row[j])
+					byte |= 0x80 >> bit;
+			}
+			packed_row[b] = byte;
+		}
+	}
+}
+
+/**
+ * COLLECTIVE
+ * every process that opened file writes its own tile, the grid header starts at offset.
+ * cells points to the first cell of the tile, rows are stride cells apart.
+ * returns the first MPI error, MPI_SUCCESS if the grid was written.
+ */
+inline int write_grid_at(MPI_File file, MPI_Offset offset, bool writes_header, GridFormat format, const GridTile& tile, const uint8_t* cells, int stride) {
+	int err = MPI_SUCCESS;
+	std::string header = grid_header(format, tile.rows, tile.cols);
+	if(writes_header)
+		err = MPI_File_write_at(file, offset, header.data(), header.size(), MPI_CHAR, MPI_STATUS_IGNORE);
+
+	// after the header the file is a rows x row_bytes matrix, each process sees only its tile
+	int row_bytes, first_byte, tile_bytes;
+	grid_row_bytes(format, tile, row_bytes, first_byte, tile_bytes);
+	const int sizes[] = { tile.rows, row_bytes };
+	const int tile_sizes[] = { tile.tile_rows, tile_bytes };
+	const int starts[] = { tile.first_row, first_byte };
+	MPI_Datatype file_tile_t;
+	MPI_Type_create_subarray(2, sizes, tile_sizes, starts, MPI_ORDER_C, MPI_UINT8_T, &file_tile_t);
+	MPI_Type_commit(&file_tile_t);
+	MPI_File_set_view(file, offset + header.size(), MPI_UINT8_T, file_tile_t, "native", MPI_INFO_NULL);
+
+	int write_err;
+	if(format == GRID_RAW) {
+		// cells are already in the file format, the halo is skipped by the memory type
+		MPI_Datatype memory_tile_t;
+		MPI_Type_vector(tile.tile_rows, tile.tile_cols, stride, MPI_UINT8_T, &memory_tile_t);
+		MPI_Type_commit(&memory_tile_t);
+		write_err = MPI_File_write_all(file, cells, 1, memory_tile_t, MPI_STATUS_IGNORE);
+		MPI_Type_free(&memory_tile_t);
+	}
+	else {
+		uint8_t* packed = new uint8_t[tile.tile_rows * tile_bytes];
+		grid_pack_tile(format, tile, cells, stride, packed, tile_bytes);
+		write_err = MPI_File_write_all(file, packed, tile.tile_rows * tile_bytes, MPI_UINT8_T, MPI_STATUS_IGNORE);
+		delete[] packed;
+	}
+	if(err == MPI_SUCCESS)
+		err = write_err;
+
+	// back to the whole file as bytes, offsets of later writes aren't relative to the tile
+	MPI_File_set_view(file, 0, MPI_BYTE, MPI_BYTE, "native", MPI_INFO_NULL);
+	MPI_Type_free(&file_tile_t);
+	return err;
+}
+
+/**
+ * COLLECTIVE
+ * every process of comm writes its own tile straight to path, no process ever holds the whole grid.
+ * returns the first MPI error, MPI_SUCCESS if the file was written.
+ */
+inline int write_grid_file(MPI_Comm comm, const std::string& path, GridFormat format, const GridTile& tile, const uint8_t* cells, int stride) {
+	MPI_File file;
+	int err = MPI_File_open(comm, path.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file);
+	if(err != MPI_SUCCESS)
+		return err;
+	// an older and bigger file would keep its tail
+	MPI_File_set_size(file, 0);
+
+	int rank;
+	MPI_Comm_rank(comm, &rank);
+	err = write_grid_at(file, 0, rank == 0, format, tile, cells, stride);
+	MPI_File_close(&file);
+	return err;
+}
+
+
+// what the header of a file being loaded says
+struct GridFileInfo
+{
+	GridFormat format;
+	int rows;
+	int cols;
+	// PGM ONLY
+	int max_value;
+	// from the start of the file, the grid starts right after it
+	int header_size;
+};
+
+// next whitespace separated number of a pnm header, comments run to the end of the line
+inline bool read_pnm_number(const char* bytes, int size, int& pos, int& number) {
+	while(pos < size && (std::isspace((unsigned char)bytes[pos]) || bytes[pos] == '#')) {
+		if(bytes[pos] == '#')
+			while(pos < size && bytes[pos] != '\n') pos++;
+		else pos++;
+	}
+	if(pos >= size || !std::isdigit((unsigned char)bytes[pos]))
+		return false;
+
+	long long value = 0;
+	while(pos < size && std::isdigit((unsigned char)bytes[pos])) {
+		value = value * 10 + (bytes[pos++] - '0');
+		if(value > INT32_MAX)
+			return false;
+	}
+	number = value;
+	return true;
+}
+
+inline bool parse_grid_header(const char* bytes, int size, GridFileInfo& info) {
+	if(size >= GRID_RAW_HEADER_SIZE && std::memcmp(bytes, GRID_RAW_MAGIC, 4) == 0) {
+		uint32_t fields[3];
+		std::memcpy(fields, &bytes[4], sizeof(fields));
+		if(fields[0] != GRID_RAW_VERSION || fields[1] > INT32_MAX || fields[2] > INT32_MAX)
+			return false;
+		info = { GRID_RAW, (int)fields[1], (int)fields[2], 1, GRID_RAW_HEADER_SIZE };
+		return true;
+	}
+
+	if(size < 2 || bytes[0] != 'P' || (bytes[1] != '4' && bytes[1] != '5'))
+		return false;
+	info.format = bytes[1] == '4' ? GRID_PBM : GRID_PGM;
+	info.max_value = 1;
+
+	int pos = 2;
+	if(!read_pnm_number(bytes, size, pos, info.cols) || !read_pnm_number(bytes, size, pos, info.rows))
+		return false;
+	// two bytes per cell greymaps aren't supported
+	if(info.format == GRID_PGM && (!read_pnm_number(bytes, size, pos, info.max_value) || info.max_value < 1 || info.max_value > 255))
+		return false;
+
+	// a single whitespace separates the header from the grid
+	if(pos >= size || !std::isspace((unsigned char)bytes[pos]))
+		return false;
+	info.header_size = pos + 1;
+	return true;
+}
+
+/**
+ * COLLECTIVE
+ * the first process of comm reads the header starting at offset and shares it with the others.
+ * returns false if the file can't be opened or isn't in a known format.
+ */
+inline bool read_grid_header(MPI_Comm comm, const std::string& path, GridFileInfo& info, int offset = 0) {
+	MPI_File file;
+	if(MPI_File_open(comm, path.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS)
+		return false;
+
+	int rank;
+	MPI_Comm_rank(comm, &rank);
+	int fields[6] = { 0 };
+	if(rank == 0) {
+		char bytes[GRID_MAX_HEADER_SIZE];
+		MPI_Status status;
+		int size = 0;
+		if(MPI_File_read_at(file, offset, bytes, GRID_MAX_HEADER_SIZE, MPI_CHAR, &status) == MPI_SUCCESS)
+			MPI_Get_count(&status, MPI_CHAR, &size);
+		fields[0] = parse_grid_header(bytes, size, info);
+		info.header_size += offset;
+		fields[1] = info.format;
+		fields[2] = info.rows;
+		fields[3] = info.cols;
+		fields[4] = info.max_value;
+		fields[5] = info.header_size;
+	}
+	MPI_Bcast(fields, 6, MPI_INT, 0, comm);
+	MPI_File_close(&file);
+
+	info = { (GridFormat)fields[1], fields[2], fields[3], fields[4], fields[5] };
+	return fields[0] && info.rows > 0 && info.cols > 0;
+}
+
+/**
+ * COLLECTIVE
+ * every process of comm reads its own tile plus halo cells around it straight from path.
+ * cells points to the first cell of the tile, rows are stride cells apart,
+ * halo cells out of the whole grid are left untouched.
+ * returns the first MPI error, GRID_ERR_TRUNCATED or GRID_ERR_BAD_CELL, MPI_SUCCESS if the tile was read.
+ */
+inline int read_grid_file(MPI_Comm comm, const std::string& path, const GridFileInfo& info, const GridTile& tile, int halo, uint8_t* cells, int stride) {
+	MPI_File file;
+	int err = MPI_File_open(comm, path.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &file);
+	if(err != MPI_SUCCESS)
+		return err;
+
+	// tile and halo, clipped to the whole grid
+	int first_row = std::max(tile.first_row - halo, 0);
+	int first_col = std::max(tile.first_col - halo, 0);
+	int last_row = std::min(tile.first_row + tile.tile_rows + halo, info.rows);
+	int last_col = std::min(tile.first_col + tile.tile_cols + halo, info.cols);
+	int read_rows = last_row - first_row;
+	int read_cols = last_col - first_col;
+	uint8_t* dest = &cells[(first_row - tile.first_row) * stride + (first_col - tile.first_col)];
+
+	int row_bytes = info.cols;
+	int first_byte = first_col;
+	int last_byte = last_col;
+	if(info.format == GRID_PBM) {
+		row_bytes = (info.cols + 7) / 8;
+		first_byte = first_col / 8;
+		last_byte = (last_col + 7) / 8;
+	}
+	int read_bytes = last_byte - first_byte;
+
+	// a short file would leave part of the tile unread
+	MPI_Offset file_size;
+	err = MPI_File_get_size(file, &file_size);
+	if(err == MPI_SUCCESS && file_size < info.header_size + (MPI_Offset)info.rows * row_bytes)
+		err = GRID_ERR_TRUNCATED;
+	if(err != MPI_SUCCESS) {
+		MPI_File_close(&file);
+		return err;
+	}
+
+	const int sizes[] = { info.rows, row_bytes };
+	const int read_sizes[] = { read_rows, read_bytes };
+	const int starts[] = { first_row, first_byte };
+	MPI_Datatype file_tile_t;
+	MPI_Type_create_subarray(2, sizes, read_sizes, starts, MPI_ORDER_C, MPI_UINT8_T, &file_tile_t);
+	MPI_Type_commit(&file_tile_t);
+	MPI_File_set_view(file, info.header_size, MPI_UINT8_T, file_tile_t, "native", MPI_INFO_NULL);
+
+	if(info.format == GRID_RAW) {
+		// the file already holds cells, they go straight in the grid
+		MPI_Datatype memory_tile_t;
+		MPI_Type_vector(read_rows, read_cols, stride, MPI_UINT8_T, &memory_tile_t);
+		MPI_Type_commit(&memory_tile_t);
+		MPI_Status status;
+		err = MPI_File_read_all(file, dest, 1, memory_tile_t, &status);
+		MPI_Type_free(&memory_tile_t);
+
+		int read_cells = 0;
+		if(err == MPI_SUCCESS)
+			MPI_Get_elements(&status, MPI_UINT8_T, &read_cells);
+		if(err == MPI_SUCCESS && read_cells != read_rows * read_cols)
+			err = GRID_ERR_TRUNCATED;
+		// any other value breaks the neighbour count
+		for(int i = 0; err == MPI_SUCCESS && i < read_rows; i++) {
+			for(int j = 0; j < read_cols; j++) {
+				if(dest[i * stride + j] > 1) {
+					err = GRID_ERR_BAD_CELL;
+					break;
+				}
+			}
+		}
+	}
+	else {
+		uint8_t* packed = new uint8_t[read_rows * read_bytes];
+		MPI_Status status;
+		err = MPI_File_read_all(file, packed, read_rows * read_bytes, MPI_UINT8_T, &status);
+		int read_count = 0;
+		if(err == MPI_SUCCESS)
+			MPI_Get_count(&status, MPI_UINT8_T, &read_count);
+		if(err == MPI_SUCCESS && read_count != read_rows * read_bytes)
+			err = GRID_ERR_TRUNCATED;
+		for(int i = 0; err == MPI_SUCCESS && i < read_rows; i++) {
+			const uint8_t* packed_row = &packed[i * read_bytes];
+			uint8_t* row = &dest[i * stride];
+			if(info.format == GRID_PGM) {
+				// dark pixels are walls
+				for(int j = 0; j < read_cols; j++)
+					row[j] = packed_row[j] <= info.max_value / 2;
+				continue;
+			}
+			for(int j = 0; j < read_cols; j++) {
+				int col = first_col + j;
+				row[j] = (packed_row[col / 8 - first_byte] >> (7 - col % 8)) & 1;
+			}
+		}
+		delete[] packed;
+	}
+
+	MPI_Type_free(&file_tile_t);
+	MPI_File_close(&file);
+	return err;
+}
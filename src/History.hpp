@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+
+#include "CaveRecord.hpp"
+
+
+/**
+ * the latest frames shown, kept in a bounded amount of memory so they can be shown again.
+ * frames are compressed like a cave recording: a keyframe now and then, and in between the xor
+ * with the frame before, run-length encoded. when the memory runs out the oldest keyframe
+ * goes away together with the deltas that depend on it.
+ * Info is whatever has to come back with the frame (generation, view...).
+ */
+template<class Info>
+class FrameHistory
+{
+public:
+	FrameHistory() {}
+	~FrameHistory() {
+		delete[] packed;
+		delete[] previous;
+	}
+
+	FrameHistory(const FrameHistory&) = delete;
+	FrameHistory& operator=(const FrameHistory&) = delete;
+
+	/**
+	 * frames of rows x cols cells, bit-packed if cells are only 0 or 1.
+	 * memory_budget is in bytes, 0 keeps no history at all
+	 */
+	void initialize(int rows, int cols, bool is_binary, size_t memory_budget, int keyframe_interval) {
+		this->rows = rows;
+		this->cols = cols;
+		this->is_binary = is_binary;
+		this->memory_budget = memory_budget;
+		this->keyframe_interval = keyframe_interval;
+		packed_size = is_binary ? (size_t)rows * ((cols + 7) / 8) : (size_t)rows * cols;
+		packed = new uint8_t[packed_size];
+		previous = new uint8_t[packed_size];
+	}
+
+	void push(const uint8_t* cells, const Info& info) {
+		if(memory_budget < packed_size)
+			return;
+
+		pack(cells, packed);
+		Entry entry = { info, false, std::string() };
+		if(!entries.empty() && frames_since_keyframe < keyframe_interval) {
+			cave_record_encode_delta(packed, previous, packed_size, entry.data);
+			// a delta as large as a keyframe saves nothing, and costs a decode
+			if(entry.data.size() >= packed_size)
+				entry.data.clear();
+		}
+		if(entry.data.empty()) {
+			entry.is_keyframe = true;
+			entry.data.assign((const char*)packed, packed_size);
+			frames_since_keyframe = 0;
+		}
+		frames_since_keyframe++;
+		std::swap(packed, previous);
+
+		memory_used += entry.data.size();
+		entries.push_back(std::move(entry));
+		drop_oldest();
+	}
+
+	int size() const { return entries.size(); }
+	size_t memory() const { return memory_used; }
+
+	// index 0 is the oldest frame kept, returns false if there's no such frame
+	bool get(int index, uint8_t* cells, Info& info) {
+		if(index < 0 || index >= (int)entries.size())
+			return false;
+
+		int keyframe = index;
+		while(!entries[keyframe].is_keyframe) keyframe--;
+		std::memcpy(packed, entries[keyframe].data.data(), packed_size);
+		for(int i = keyframe + 1; i <= index; i++)
+			cave_record_apply_delta((const uint8_t*)entries[i].data.data(), entries[i].data.size(), packed, packed_size);
+
+		unpack(packed, cells);
+		info = entries[index].info;
+		return true;
+	}
+
+private:
+	struct Entry {
+		Info info;
+		bool is_keyframe;
+		// the packed frame, or the delta with the frame before
+		std::string data;
+	};
+
+	int rows = 0;
+	int cols = 0;
+	bool is_binary = true;
+	size_t memory_budget = 0;
+	size_t memory_used = 0;
+	int keyframe_interval = 1;
+	int frames_since_keyframe = 0;
+	size_t packed_size = 0;
+	// previous holds the last frame pushed, packed is scratch
+	uint8_t* packed = nullptr;
+	uint8_t* previous = nullptr;
+	std::deque<Entry> entries;
+
+	void pack(const uint8_t* cells, uint8_t* dest) {
+		if(is_binary)
+			cave_record_pack(cells, rows, cols, dest);
+		else std::memcpy(dest, cells, packed_size);
+	}
+
+	void unpack(const uint8_t* src, uint8_t* cells) {
+		if(is_binary)
+			cave_record_unpack(src, rows, cols, cells);
+		else std::memcpy(cells, src, packed_size);
+	}
+
+	// drops whole groups of a keyframe and its deltas, the newest group always stays
+	void drop_oldest() {
+		while(memory_used > memory_budget) {
+			size_t group_end = 1;
+			while(group_end < entries.size() && !entries[group_end].is_keyframe) group_end++;
+			if(group_end == entries.size())
+				return;
+			for(size_t i = 0; i < group_end; i++) {
+				memory_used -= entries.front().data.size();
+				entries.pop_front();
+			}
+		}
+	}
+};
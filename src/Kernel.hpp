@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+
+
+/**
+ * the cell update of a generation, shared by cavegen and the kernel benchmark.
+ * grids are rows x cols with a radius wide halo around the inner cells, only inner cells are written.
+ * a cell becomes a wall when at least half of its neighbours plus roughness are walls,
+ * floor when at most half minus roughness are, and stays the same otherwise
+ */
+
+// half the number of cells around a cell
+inline int half_neighbours(int radius) {
+	return 2 * radius * (radius + 1);
+}
+
+// walls in the (2 * radius + 1) square around (y, x), the cell itself excluded
+inline int get_neighbour_walls(const uint8_t* grid, int cols, int radius, int y, int x) {
+	int walls = 0;
+	for(int i = y - radius; i <= y + radius; i++)
+		for(int j = x - radius; j <= x + radius; j++)
+			walls += grid[i * cols + j];
+
+	walls -= grid[y * cols + x];
+	return walls;
+}
+
+// the reference, every other kernel must write the same cells
+inline void update_cells(const uint8_t* read_grid, uint8_t* write_grid, int rows, int cols, int radius, int roughness) {
+	int half = half_neighbours(radius);
+	for(int i = radius; i < rows - radius; i++) {
+		for(int j = radius; j < cols - radius; j++) {
+			int walls = get_neighbour_walls(read_grid, cols, radius, i, j);
+
+			if(walls >= half + roughness)
+				write_grid[i * cols + j] = 1;
+			else if(walls <= half - roughness)
+				write_grid[i * cols + j] = 0;
+			else
+				write_grid[i * cols + j] = read_grid[i * cols + j];
+		}
+	}
+}
+
+// same count as the reference, walking row pointers and picking the new cell without branches
+inline void update_cells_branchless(const uint8_t* read_grid, uint8_t* write_grid, int rows, int cols, int radius, int roughness) {
+	int half = half_neighbours(radius);
+	int wall_above = half + roughness;
+	int floor_below = half - roughness;
+	for(int i = radius; i < rows - radius; i++) {
+		const uint8_t* row = &read_grid[i * cols];
+		uint8_t* out = &write_grid[i * cols];
+		for(int j = radius; j < cols - radius; j++) {
+			int walls = -row[j];
+			for(int k = -radius; k <= radius; k++) {
+				const uint8_t* neighbours = &read_grid[(i + k) * cols + j - radius];
+				for(int l = 0; l <= 2 * radius; l++)
+					walls += neighbours[l];
+			}
+			out[j] = (walls >= wall_above) | ((walls > floor_below) & row[j]);
+		}
+	}
+}
+
+/**
+ * keeps the walls of every column over the 2 * radius + 1 rows around the current one, moving them down a row
+ * at a time, and slides a window of 2 * radius + 1 of those sums along the row.
+ * a few additions per cell whatever the radius. column_walls holds cols ints
+ */
+inline void update_cells_sliding(const uint8_t* read_grid, uint8_t* write_grid, int rows, int cols, int radius, int roughness,
+	int* column_walls) {
+	int half = half_neighbours(radius);
+	int width = 2 * radius + 1;
+	for(int j = 0; j < cols; j++) {
+		int walls = 0;
+		for(int k = 0; k < width; k++)
+			walls += read_grid[k * cols + j];
+		column_walls[j] = walls;
+	}
+
+	for(int i = radius; i < rows - radius; i++) {
+		if(i > radius) {
+			const uint8_t* leaving = &read_grid[(i - radius - 1) * cols];
+			const uint8_t* entering = &read_grid[(i + radius) * cols];
+			for(int j = 0; j < cols; j++)
+				column_walls[j] += entering[j] - leaving[j];
+		}
+
+		const uint8_t* row = &read_grid[i * cols];
+		uint8_t* out = &write_grid[i * cols];
+		int walls = 0;
+		for(int j = 0; j < width - 1; j++)
+			walls += column_walls[j];
+		for(int j = radius; j < cols - radius; j++) {
+			walls += column_walls[j + radius];
+			int neighbour_walls = walls - row[j];
+			if(neighbour_walls >= half + roughness)
+				out[j] = 1;
+			else if(neighbour_walls <= half - roughness)
+				out[j] = 0;
+			else
+				out[j] = row[j];
+			walls -= column_walls[j - radius];
+		}
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+
+/**
+ * one duration per generation, stored in a buffer allocated before the run
+ * so recording a sample costs a single store
+ */
+class LatencySamples
+{
+public:
+	void allocate(size_t capacity) {
+		samples.assign(std::max((size_t)1, capacity), 0);
+		count = 0;
+	}
+
+	void add(double seconds) {
+		samples[count % samples.size()] = seconds;
+		count++;
+	}
+
+	size_t size() const { return std::min(count, samples.size()); }
+	double* data() { return samples.data(); }
+
+private:
+	std::vector<double> samples;
+	size_t count = 0;
+};
+
+struct LatencySummary
+{
+	double min, p50, p95, p99, max;
+};
+
+// nearest rank percentiles, samples get reordered
+inline LatencySummary summarize_latency(double* samples, size_t count) {
+	if(count == 0)
+		return { 0, 0, 0, 0, 0 };
+
+	auto percentile = [&](double fraction) {
+		size_t rank = std::min(count - 1, (size_t)std::max(1.0, std::ceil(fraction * count)) - 1);
+		std::nth_element(samples, samples + rank, samples + count);
+		return samples[rank];
+	};
+	LatencySummary summary;
+	summary.p50 = percentile(0.50);
+	summary.p95 = percentile(0.95);
+	summary.p99 = percentile(0.99);
+	summary.min = *std::min_element(samples, samples + count);
+	summary.max = *std::max_element(samples, samples + count);
+	return summary;
+}
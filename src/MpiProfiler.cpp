@@ -0,0 +1,388 @@
+#include <mpi.h>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "MpiProfiler.hpp"
+
+
+/**
+ * PMPI interposition: these MPI_ functions replace the library ones in the program
+ * and call the real ones through their PMPI_ names.
+ *
+ * a blocking receive is split in a probe, the time waiting for a late sender,
+ * and the receive itself, the time the transfer takes once the message is there.
+ * on a 2D cartesian communicator peers are also counted by direction,
+ * (-1, 0) is the neighbour above and (0, 1) the one on the right.
+ */
+
+namespace {
+
+enum Collective {
+	COLLECTIVE_GATHER, COLLECTIVE_GATHERV, COLLECTIVE_SCATTER, COLLECTIVE_SCATTERV,
+	COLLECTIVE_BCAST, COLLECTIVE_REDUCE, COLLECTIVE_ALLREDUCE, COLLECTIVE_BARRIER,
+	COLLECTIVES
+};
+
+const char* collective_names[COLLECTIVES] = {
+	"MPI_Gather", "MPI_Gatherv", "MPI_Scatter", "MPI_Scatterv", "MPI_Bcast", "MPI_Reduce", "MPI_Allreduce", "MPI_Barrier"
+};
+
+// what the profiler needs to know about a communicator, built the first time it's used
+struct CommInfo {
+	// world rank of every rank in the communicator
+	std::vector<int> world_ranks;
+	bool is_cartesian;
+	// cartesian coordinates of every rank
+	std::vector<int> coords;
+	int my_rank;
+};
+
+// counters of a single process
+struct Profile {
+	// indexed by world rank of the peer
+	std::vector<double> sent_messages, sent_bytes;
+	std::vector<double> received_messages, received_bytes;
+	std::vector<double> receive_wait, receive_transfer;
+
+	// by direction on a cartesian communicator, [dy + 1][dx + 1]
+	double direction_sent_messages[3][3], direction_sent_bytes[3][3];
+	double direction_receive_wait[3][3], direction_receive_transfer[3][3];
+
+	double collective_calls[COLLECTIVES], collective_time[COLLECTIVES];
+};
+
+bool is_profiling = false;
+std::string report_path;
+int world_rank, world_size;
+Profile profile;
+std::map<MPI_Comm, CommInfo> comm_infos;
+
+const CommInfo& comm_info(MPI_Comm comm) {
+	auto found = comm_infos.find(comm);
+	if(found != comm_infos.end())
+		return found->second;
+
+	CommInfo& info = comm_infos[comm];
+	int size;
+	PMPI_Comm_size(comm, &size);
+	PMPI_Comm_rank(comm, &info.my_rank);
+
+	MPI_Group group, world_group;
+	PMPI_Comm_group(comm, &group);
+	PMPI_Comm_group(MPI_COMM_WORLD, &world_group);
+	std::vector<int> ranks(size);
+	for(int r = 0; r < size; r++)
+		ranks[r] = r;
+	info.world_ranks.resize(size);
+	PMPI_Group_translate_ranks(group, size, ranks.data(), world_group, info.world_ranks.data());
+	PMPI_Group_free(&group);
+	PMPI_Group_free(&world_group);
+
+	int topology, dims = 0;
+	PMPI_Topo_test(comm, &topology);
+	if(topology == MPI_CART)
+		PMPI_Cartdim_get(comm, &dims);
+	info.is_cartesian = dims == 2;
+	if(info.is_cartesian) {
+		info.coords.resize(2 * size);
+		for(int r = 0; r < size; r++)
+			PMPI_Cart_coords(comm, r, 2, &info.coords[2 * r]);
+	}
+	return info;
+}
+
+// false if the peer isn't a next door neighbour on a 2D cartesian communicator
+bool peer_direction(const CommInfo& info, int peer, int& dy, int& dx) {
+	if(!info.is_cartesian)
+		return false;
+	dy = info.coords[2 * peer] - info.coords[2 * info.my_rank];
+	dx = info.coords[2 * peer + 1] - info.coords[2 * info.my_rank + 1];
+	return dy >= -1 && dy <= 1 && dx >= -1 && dx <= 1;
+}
+
+double type_bytes(MPI_Datatype datatype, int count) {
+	int size;
+	PMPI_Type_size(datatype, &size);
+	return (double)size * count;
+}
+
+void count_send(int count, MPI_Datatype datatype, int dest, MPI_Comm comm) {
+	if(dest == MPI_PROC_NULL)
+		return;
+	const CommInfo& info = comm_info(comm);
+	int peer = info.world_ranks[dest];
+	double bytes = type_bytes(datatype, count);
+	profile.sent_messages[peer]++;
+	profile.sent_bytes[peer] += bytes;
+
+	int dy, dx;
+	if(peer_direction(info, dest, dy, dx)) {
+		profile.direction_sent_messages[dy + 1][dx + 1]++;
+		profile.direction_sent_bytes[dy + 1][dx + 1] += bytes;
+	}
+}
+
+void count_collective(Collective collective, double start_time) {
+	profile.collective_calls[collective]++;
+	profile.collective_time[collective] += PMPI_Wtime() - start_time;
+}
+
+void reset_profile() {
+	profile = Profile();
+	profile.sent_messages.assign(world_size, 0);
+	profile.sent_bytes.assign(world_size, 0);
+	profile.received_messages.assign(world_size, 0);
+	profile.received_bytes.assign(world_size, 0);
+	profile.receive_wait.assign(world_size, 0);
+	profile.receive_transfer.assign(world_size, 0);
+	for(int i = 0; i < 3; i++) {
+		for(int j = 0; j < 3; j++) {
+			profile.direction_sent_messages[i][j] = profile.direction_sent_bytes[i][j] = 0;
+			profile.direction_receive_wait[i][j] = profile.direction_receive_transfer[i][j] = 0;
+		}
+	}
+	std::fill_n(profile.collective_calls, COLLECTIVES, 0);
+	std::fill_n(profile.collective_time, COLLECTIVES, 0);
+}
+
+// a world_size x world_size matrix, a row for every process
+void write_matrix(std::ostream& os, const std::string& title, const std::vector<double>& matrix) {
+	os << "# " << title << std::endl;
+	for(int from = 0; from < world_size; from++) {
+		for(int to = 0; to < world_size; to++)
+			os << (to > 0 ? "," : "") << matrix[from * world_size + to];
+		os << std::endl;
+	}
+	os << std::endl;
+}
+
+void write_direction_table(std::ostream& os, const double* values, const std::string& title) {
+	os << "# " << title << ", rows dy = -1 0 1, columns dx = -1 0 1" << std::endl;
+	for(int i = 0; i < 3; i++)
+		os << values[i * 3] << "," << values[i * 3 + 1] << "," << values[i * 3 + 2] << std::endl;
+	os << std::endl;
+}
+
+/**
+ * COLLECTIVE
+ * world rank 0 sums the counters of every process, prints a summary and writes the matrices
+ */
+void write_report() {
+	// every process gathers a row of each matrix
+	const std::vector<double>* rows[6] = {
+		&profile.sent_messages, &profile.sent_bytes, &profile.received_messages,
+		&profile.received_bytes, &profile.receive_wait, &profile.receive_transfer
+	};
+	std::vector<double> matrices[6];
+	for(int m = 0; m < 6; m++) {
+		if(world_rank == 0)
+			matrices[m].resize(world_size * world_size);
+		PMPI_Gather(rows[m]->data(), world_size, MPI_DOUBLE, matrices[m].data(), world_size, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+	}
+
+	double directions[4][9], collectives[2][COLLECTIVES];
+	PMPI_Reduce(profile.direction_sent_messages, directions[0], 9, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+	PMPI_Reduce(profile.direction_sent_bytes, directions[1], 9, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+	PMPI_Reduce(profile.direction_receive_wait, directions[2], 9, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+	PMPI_Reduce(profile.direction_receive_transfer, directions[3], 9, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+	PMPI_Reduce(profile.collective_calls, collectives[0], COLLECTIVES, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+	PMPI_Reduce(profile.collective_time, collectives[1], COLLECTIVES, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+	if(world_rank != 0)
+		return;
+
+	auto total = [](const std::vector<double>& matrix) {
+		double sum = 0;
+		for(double value : matrix) sum += value;
+		return sum;
+	};
+	std::cout << std::endl << "MPI profile, summed over " << world_size << " processes:" << std::endl;
+	std::cout << "Sent:               " << total(matrices[0]) << " messages, " << total(matrices[1]) << " B" << std::endl;
+	std::cout << "Receives:           " << total(matrices[4]) << " s waiting for the sender, "
+		<< total(matrices[5]) << " s receiving" << std::endl;
+
+	std::cout << "By direction:       " << std::setw(8) << "dy,dx" << std::setw(12) << "messages" << std::setw(14) << "bytes"
+		<< std::setw(12) << "wait (s)" << std::setw(14) << "receive (s)" << std::endl;
+	for(int i = 0; i < 3; i++) {
+		for(int j = 0; j < 3; j++) {
+			if(directions[0][i * 3 + j] == 0 && directions[2][i * 3 + j] == 0)
+				continue;
+			std::cout << std::setw(28) << std::to_string(i - 1) + "," + std::to_string(j - 1)
+				<< std::setw(12) << directions[0][i * 3 + j] << std::setw(14) << directions[1][i * 3 + j]
+				<< std::setw(12) << directions[2][i * 3 + j] << std::setw(14) << directions[3][i * 3 + j] << std::endl;
+		}
+	}
+
+	for(int c = 0; c < COLLECTIVES; c++) {
+		if(collectives[0][c] == 0)
+			continue;
+		std::cout << std::left << std::setw(20) << std::string(collective_names[c]) + ":" << std::right
+			<< collectives[0][c] << " calls, " << collectives[1][c] << " s" << std::endl;
+	}
+
+	std::ofstream file(report_path);
+	if(!file.is_open()) {
+		std::cout << "Failed to write the MPI profile to " << report_path << std::endl;
+		return;
+	}
+	write_matrix(file, "messages sent, row = sender, column = receiver (world ranks)", matrices[0]);
+	write_matrix(file, "bytes sent, row = sender, column = receiver", matrices[1]);
+	write_matrix(file, "messages received, row = receiver, column = sender", matrices[2]);
+	write_matrix(file, "bytes received, row = receiver, column = sender", matrices[3]);
+	write_matrix(file, "seconds waiting for a late sender, row = receiver, column = sender", matrices[4]);
+	write_matrix(file, "seconds receiving, row = receiver, column = sender", matrices[5]);
+	write_direction_table(file, directions[0], "messages sent by direction");
+	write_direction_table(file, directions[1], "bytes sent by direction");
+	write_direction_table(file, directions[2], "seconds waiting by direction of the sender");
+	write_direction_table(file, directions[3], "seconds receiving by direction of the sender");
+	file << "# collective,calls,seconds" << std::endl;
+	for(int c = 0; c < COLLECTIVES; c++)
+		file << collective_names[c] << "," << collectives[0][c] << "," << collectives[1][c] << std::endl;
+	std::cout << "MPI profile written to " << report_path << std::endl;
+}
+
+}
+
+
+void mpi_profiler_start(const std::string& path) {
+	PMPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+	PMPI_Comm_size(MPI_COMM_WORLD, &world_size);
+	report_path = path;
+	reset_profile();
+	PMPI_Barrier(MPI_COMM_WORLD);
+	is_profiling = true;
+}
+
+
+int MPI_Send(const void* buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm) {
+	if(is_profiling)
+		count_send(count, datatype, dest, comm);
+	return PMPI_Send(buf, count, datatype, dest, tag, comm);
+}
+
+int MPI_Isend(const void* buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm, MPI_Request* request) {
+	if(is_profiling)
+		count_send(count, datatype, dest, comm);
+	return PMPI_Isend(buf, count, datatype, dest, tag, comm, request);
+}
+
+int MPI_Recv(void* buf, int count, MPI_Datatype datatype, int source, int tag, MPI_Comm comm, MPI_Status* status) {
+	if(!is_profiling || source == MPI_PROC_NULL)
+		return PMPI_Recv(buf, count, datatype, source, tag, comm, status);
+
+	// the probe returns once the message is there, the receive that follows gets that very message
+	MPI_Status probe_status;
+	double start_time = PMPI_Wtime();
+	int err = PMPI_Probe(source, tag, comm, &probe_status);
+	if(err != MPI_SUCCESS)
+		return err;
+	double arrival_time = PMPI_Wtime();
+	MPI_Status recv_status;
+	err = PMPI_Recv(buf, count, datatype, probe_status.MPI_SOURCE, probe_status.MPI_TAG, comm, &recv_status);
+	double end_time = PMPI_Wtime();
+	if(status != MPI_STATUS_IGNORE)
+		*status = recv_status;
+
+	const CommInfo& info = comm_info(comm);
+	int peer = info.world_ranks[probe_status.MPI_SOURCE];
+	int received_count;
+	PMPI_Get_count(&recv_status, datatype, &received_count);
+	profile.received_messages[peer]++;
+	if(received_count != MPI_UNDEFINED)
+		profile.received_bytes[peer] += type_bytes(datatype, received_count);
+	profile.receive_wait[peer] += arrival_time - start_time;
+	profile.receive_transfer[peer] += end_time - arrival_time;
+
+	int dy, dx;
+	if(peer_direction(info, probe_status.MPI_SOURCE, dy, dx)) {
+		profile.direction_receive_wait[dy + 1][dx + 1] += arrival_time - start_time;
+		profile.direction_receive_transfer[dy + 1][dx + 1] += end_time - arrival_time;
+	}
+	return err;
+}
+
+int MPI_Gather(const void* sendbuf, int sendcount, MPI_Datatype sendtype, void* recvbuf, int recvcount, MPI_Datatype recvtype,
+	int root, MPI_Comm comm) {
+	double start_time = PMPI_Wtime();
+	int err = PMPI_Gather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, root, comm);
+	if(is_profiling)
+		count_collective(COLLECTIVE_GATHER, start_time);
+	return err;
+}
+
+int MPI_Gatherv(const void* sendbuf, int sendcount, MPI_Datatype sendtype, void* recvbuf, const int recvcounts[], const int displs[],
+	MPI_Datatype recvtype, int root, MPI_Comm comm) {
+	double start_time = PMPI_Wtime();
+	int err = PMPI_Gatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs, recvtype, root, comm);
+	if(is_profiling)
+		count_collective(COLLECTIVE_GATHERV, start_time);
+	return err;
+}
+
+int MPI_Scatter(const void* sendbuf, int sendcount, MPI_Datatype sendtype, void* recvbuf, int recvcount, MPI_Datatype recvtype,
+	int root, MPI_Comm comm) {
+	double start_time = PMPI_Wtime();
+	int err = PMPI_Scatter(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, root, comm);
+	if(is_profiling)
+		count_collective(COLLECTIVE_SCATTER, start_time);
+	return err;
+}
+
+int MPI_Scatterv(const void* sendbuf, const int sendcounts[], const int displs[], MPI_Datatype sendtype, void* recvbuf, int recvcount,
+	MPI_Datatype recvtype, int root, MPI_Comm comm) {
+	double start_time = PMPI_Wtime();
+	int err = PMPI_Scatterv(sendbuf, sendcounts, displs, sendtype, recvbuf, recvcount, recvtype, root, comm);
+	if(is_profiling)
+		count_collective(COLLECTIVE_SCATTERV, start_time);
+	return err;
+}
+
+int MPI_Bcast(void* buffer, int count, MPI_Datatype datatype, int root, MPI_Comm comm) {
+	double start_time = PMPI_Wtime();
+	int err = PMPI_Bcast(buffer, count, datatype, root, comm);
+	if(is_profiling)
+		count_collective(COLLECTIVE_BCAST, start_time);
+	return err;
+}
+
+int MPI_Reduce(const void* sendbuf, void* recvbuf, int count, MPI_Datatype datatype, MPI_Op op, int root, MPI_Comm comm) {
+	double start_time = PMPI_Wtime();
+	int err = PMPI_Reduce(sendbuf, recvbuf, count, datatype, op, root, comm);
+	if(is_profiling)
+		count_collective(COLLECTIVE_REDUCE, start_time);
+	return err;
+}
+
+int MPI_Allreduce(const void* sendbuf, void* recvbuf, int count, MPI_Datatype datatype, MPI_Op op, MPI_Comm comm) {
+	double start_time = PMPI_Wtime();
+	int err = PMPI_Allreduce(sendbuf, recvbuf, count, datatype, op, comm);
+	if(is_profiling)
+		count_collective(COLLECTIVE_ALLREDUCE, start_time);
+	return err;
+}
+
+int MPI_Barrier(MPI_Comm comm) {
+	double start_time = PMPI_Wtime();
+	int err = PMPI_Barrier(comm);
+	if(is_profiling)
+		count_collective(COLLECTIVE_BARRIER, start_time);
+	return err;
+}
+
+// a new communicator may get the handle of a freed one
+int MPI_Comm_free(MPI_Comm* comm) {
+	comm_infos.erase(*comm);
+	return PMPI_Comm_free(comm);
+}
+
+int MPI_Finalize() {
+	if(is_profiling) {
+		is_profiling = false;
+		write_report();
+	}
+	return PMPI_Finalize();
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string>
+
+
+/**
+ * MPI profiler, the PMPI wrappers in MpiProfiler.cpp count the messages and bytes sent to every process
+ * and the time spent blocked in receives and collectives.
+ * nothing is counted until it's started, the report is written when MPI is finalized
+ */
+
+// COLLECTIVE, starts counting on every process, world rank 0 writes the report to report_path
+void mpi_profiler_start(const std::string& report_path);
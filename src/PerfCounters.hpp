@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+/**
+ * hardware counters of this process read with perf_event_open, user space only so they work
+ * unprivileged when perf_event_paranoid allows it.
+ * every counter is opened on its own, the ones the kernel or the cpu don't offer are just missing.
+ * counters may be multiplexed when there are more of them than the cpu has, their values are scaled
+ * by the time they actually ran
+ */
+enum PerfCounter {
+	PERF_CYCLES, PERF_INSTRUCTIONS, PERF_L1D_MISSES, PERF_LLC_MISSES, PERF_BRANCH_MISSES,
+	// cpu time in ns, tells running from waiting
+	PERF_TASK_CLOCK,
+	PERF_COUNTERS
+};
+
+inline const char* perf_counter_name(int counter) {
+	static const char* names[PERF_COUNTERS] = {
+		"cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses", "task_clock_ns"
+	};
+	return names[counter];
+}
+
+class PerfCounters
+{
+public:
+	PerfCounters() {
+		for(int c = 0; c < PERF_COUNTERS; c++)
+			fds[c] = -1;
+	}
+	~PerfCounters() { close(); }
+
+	PerfCounters(const PerfCounters&) = delete;
+	PerfCounters& operator=(const PerfCounters&) = delete;
+
+	// opens every counter it can, returns how many. error says why the first one that failed did
+	int open() {
+		int opened = 0;
+#ifdef __linux__
+		const uint32_t types[PERF_COUNTERS] = {
+			PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE
+		};
+		const uint64_t configs[PERF_COUNTERS] = {
+			PERF_COUNT_HW_CPU_CYCLES,
+			PERF_COUNT_HW_INSTRUCTIONS,
+			PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+			PERF_COUNT_HW_CACHE_MISSES,
+			PERF_COUNT_HW_BRANCH_MISSES,
+			PERF_COUNT_SW_TASK_CLOCK
+		};
+		for(int c = 0; c < PERF_COUNTERS; c++) {
+			struct perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = types[c];
+			attr.config = configs[c];
+			attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+
+			fds[c] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+			if(fds[c] >= 0)
+				opened++;
+			else if(error.empty()) {
+				error = std::string(perf_counter_name(c)) + ": " + std::strerror(errno);
+				if(errno == EACCES || errno == EPERM)
+					error += ", /proc/sys/kernel/perf_event_paranoid may not allow it";
+			}
+		}
+#else
+		error = "perf_event_open is only on linux";
+#endif
+		return opened;
+	}
+
+	void close() {
+#ifdef __linux__
+		for(int c = 0; c < PERF_COUNTERS; c++) {
+			if(fds[c] >= 0)
+				::close(fds[c]);
+			fds[c] = -1;
+		}
+#endif
+	}
+
+	bool is_available(int counter) const { return fds[counter] >= 0; }
+
+	bool is_open() const {
+		for(int c = 0; c < PERF_COUNTERS; c++)
+			if(fds[c] >= 0)
+				return true;
+		return false;
+	}
+
+	// raw value and the ns the counter was enabled and running, false if it can't be read
+	bool read(int counter, uint64_t reading[3]) const {
+#ifdef __linux__
+		return fds[counter] >= 0 && ::read(fds[counter], reading, 3 * sizeof(uint64_t)) == 3 * sizeof(uint64_t);
+#else
+		return false;
+#endif
+	}
+
+	std::string error;
+
+private:
+	int fds[PERF_COUNTERS];
+};
+
+// counters summed over every time a phase ran
+class PerfPhase
+{
+public:
+	double totals[PERF_COUNTERS] = {};
+
+	void begin(const PerfCounters& counters) {
+		for(int c = 0; c < PERF_COUNTERS; c++)
+			is_started[c] = counters.read(c, start[c]);
+	}
+
+	void end(const PerfCounters& counters) {
+		for(int c = 0; c < PERF_COUNTERS; c++) {
+			uint64_t reading[3];
+			if(!is_started[c] || !counters.read(c, reading))
+				continue;
+			uint64_t running = reading[2] - start[c][2];
+			// a multiplexed counter only saw part of the phase
+			if(running > 0)
+				totals[c] += (double)(reading[0] - start[c][0]) * (reading[1] - start[c][1]) / running;
+		}
+	}
+
+private:
+	uint64_t start[PERF_COUNTERS][3];
+	bool is_started[PERF_COUNTERS] = {};
+};
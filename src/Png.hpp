@@ -0,0 +1,525 @@
+#pragma once
+
+#include <mpi.h>
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Config.hpp"
+#include "GridIO.hpp"
+
+
+/**
+ * PNG writer for caves: 1 bit per cell, floor is palette entry 0 and wall entry 1.
+ * rows are packed like pbm, 8 cells per byte starting from the most significant bit.
+ *
+ * the image data is cut in bands deflated independently, like pigz does: every band ends
+ * with an empty stored block so the next one starts on a whole byte, and the bands are simply
+ * joined. each band is its own IDAT chunk, so its crc is computed with it, and the adler32
+ * of the bands is combined at the end. the first IDAT holds only the zlib header and the last
+ * one the final block and the adler32, so bands can come from threads or from other processes.
+ */
+
+// bytes of scanlines deflated by one thread, a band can't refer to the bytes of the one before
+#define PNG_BAND_BYTES (128 * 1024)
+
+// deflate window and matches
+#define PNG_WINDOW_SIZE 32768
+#define PNG_MIN_MATCH 3
+#define PNG_MAX_MATCH 258
+#define PNG_HASH_BITS 15
+// previous positions looked at for a longer match
+#define PNG_MAX_CHAIN 32
+
+inline uint32_t png_crc32(uint32_t crc, const uint8_t* bytes, size_t size) {
+	static uint32_t table[256];
+	static bool is_table_ready = false;
+	if(!is_table_ready) {
+		for(uint32_t n = 0; n < 256; n++) {
+			uint32_t c = n;
+			for(int k = 0; k < 8; k++)
+				c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+			table[n] = c;
+		}
+		is_table_ready = true;
+	}
+
+	crc = ~crc;
+	for(size_t i = 0; i < size; i++)
+		crc = table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+inline uint32_t png_adler32(uint32_t adler, const uint8_t* bytes, size_t size) {
+	uint32_t a = adler & 0xffff;
+	uint32_t b = adler >> 16;
+	while(size > 0) {
+		// sums can't overflow in 5552 bytes
+		size_t block = std::min(size, (size_t)5552);
+		for(size_t i = 0; i < block; i++) {
+			a += bytes[i];
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+		bytes += block;
+		size -= block;
+	}
+	return (b << 16) | a;
+}
+
+// adler32 of two byte ranges one after the other, second_size is the size of the second one
+inline uint32_t png_adler32_combine(uint32_t first, uint32_t second, uint64_t second_size) {
+	const uint32_t base = 65521;
+	uint32_t remainder = second_size % base;
+	uint64_t a = ((first & 0xffff) + (second & 0xffff) + base - 1) % base;
+	uint64_t b = ((uint64_t)remainder * (first & 0xffff) + (first >> 16) + (second >> 16) + base - remainder) % base;
+	return (uint32_t)(b << 16 | a);
+}
+
+inline void png_put_u32(std::string& out, uint32_t value) {
+	out += (char)(value >> 24);
+	out += (char)(value >> 16);
+	out += (char)(value >> 8);
+	out += (char)value;
+}
+
+inline void png_append_chunk(std::string& out, const char* type, const std::string& data) {
+	size_t start = out.size();
+	png_put_u32(out, data.size());
+	out.append(type, 4);
+	out += data;
+	// the crc covers type and data
+	png_put_u32(out, png_crc32(0, (const uint8_t*)out.data() + start + 4, out.size() - start - 4));
+}
+
+// scanlines as png wants them: a filter byte (none) then the packed row
+inline void png_pack_rows(const uint8_t* cells, int stride, int first_row, int last_row, int cols, uint8_t* scanlines) {
+	int row_bytes = (cols + 7) / 8;
+	for(int i = first_row; i < last_row; i++) {
+		const uint8_t* row = &cells[i * stride];
+		uint8_t* scanline = &scanlines[(i - first_row) * (row_bytes + 1)];
+		scanline[0] = 0;
+		for(int b = 0; b < row_bytes; b++) {
+			uint8_t byte = 0;
+			for(int bit = 0; bit < 8; bit++) {
+				int j = b * 8 + bit;
+				if(j < cols && row[j])
+					byte |= 0x80 >> bit;
+			}
+			scanline[b + 1] = byte;
+		}
+	}
+}
+
+
+// deflate bits go in starting from the least significant one
+class PngBitWriter
+{
+public:
+	PngBitWriter(std::string& out) : out(out) {}
+
+	void put(uint32_t bits, int count) {
+		buffer |= (uint64_t)bits << count_in_buffer;
+		count_in_buffer += count;
+		while(count_in_buffer >= 8) {
+			out += (char)(buffer & 0xff);
+			buffer >>= 8;
+			count_in_buffer -= 8;
+		}
+	}
+
+	void align() {
+		if(count_in_buffer > 0)
+			put(0, 8 - count_in_buffer);
+	}
+
+private:
+	std::string& out;
+	uint64_t buffer = 0;
+	int count_in_buffer = 0;
+};
+
+// huffman codes are sent from the most significant bit, so they're stored reversed
+inline uint32_t png_reverse_bits(uint32_t code, int length) {
+	uint32_t reversed = 0;
+	for(int i = 0; i < length; i++) {
+		reversed = (reversed << 1) | (code & 1);
+		code >>= 1;
+	}
+	return reversed;
+}
+
+// deflate fixed huffman codes and the length and distance symbol tables
+struct PngFixedCodes
+{
+	uint16_t literal_codes[288];
+	uint8_t literal_lengths[288];
+	uint8_t distance_codes[30];
+	// symbol and extra bits of every match length and of every distance up to the window
+	uint16_t length_symbols[PNG_MAX_MATCH + 1];
+	uint8_t length_extra[PNG_MAX_MATCH + 1];
+	uint16_t length_bases[PNG_MAX_MATCH + 1];
+	uint8_t distance_symbols[PNG_WINDOW_SIZE + 1];
+
+	PngFixedCodes() {
+		for(int symbol = 0; symbol < 288; symbol++) {
+			if(symbol < 144) set_literal(symbol, 0x30 + symbol, 8);
+			else if(symbol < 256) set_literal(symbol, 0x190 + symbol - 144, 9);
+			else if(symbol < 280) set_literal(symbol, symbol - 256, 7);
+			else set_literal(symbol, 0xc0 + symbol - 280, 8);
+		}
+		for(int symbol = 0; symbol < 30; symbol++)
+			distance_codes[symbol] = png_reverse_bits(symbol, 5);
+
+		static const uint16_t length_start[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+			35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+		static const uint8_t length_extra_bits[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+			3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+		for(int code = 0; code < 29; code++) {
+			int last = code == 28 ? PNG_MAX_MATCH : std::min(PNG_MAX_MATCH - 1, length_start[code] + (1 << length_extra_bits[code]) - 1);
+			for(int length = length_start[code]; length <= last; length++) {
+				length_symbols[length] = 257 + code;
+				length_extra[length] = length_extra_bits[code];
+				length_bases[length] = length_start[code];
+			}
+		}
+
+		for(int code = 0; code < 30; code++) {
+			int first = distance_start(code);
+			int last = std::min(PNG_WINDOW_SIZE, first + (1 << distance_extra(code)) - 1);
+			for(int distance = first; distance <= last; distance++)
+				distance_symbols[distance] = code;
+		}
+	}
+
+	static int distance_extra(int code) { return code < 4 ? 0 : code / 2 - 1; }
+	static int distance_start(int code) {
+		if(code < 4)
+			return code + 1;
+		return (1 << (code / 2)) + (code % 2) * (1 << (code / 2 - 1)) + 1;
+	}
+
+private:
+	void set_literal(int symbol, uint32_t code, int length) {
+		literal_codes[symbol] = png_reverse_bits(code, length);
+		literal_lengths[symbol] = length;
+	}
+};
+
+inline const PngFixedCodes& png_fixed_codes() {
+	static const PngFixedCodes codes;
+	return codes;
+}
+
+/**
+ * deflates bytes in blocks that aren't final, then ends them with an empty stored block,
+ * the output stops on a whole byte and can be followed by any other band.
+ * lz77 with hash chains and the fixed huffman codes, stored blocks if that comes out smaller
+ */
+inline void png_deflate_band(const uint8_t* bytes, size_t size, std::string& out) {
+	const PngFixedCodes& codes = png_fixed_codes();
+	std::string compressed;
+	PngBitWriter bits(compressed);
+	// not final, fixed huffman
+	bits.put(0b010, 3);
+
+	const uint32_t hash_size = 1 << PNG_HASH_BITS;
+	std::vector<int32_t> head(hash_size, -1);
+	std::vector<int32_t> previous(PNG_WINDOW_SIZE);
+	auto hash_at = [&](size_t pos) {
+		uint32_t value = bytes[pos] | bytes[pos + 1] << 8 | bytes[pos + 2] << 16;
+		return (value * 2654435761u) >> (32 - PNG_HASH_BITS);
+	};
+	auto insert = [&](size_t pos) {
+		if(pos + PNG_MIN_MATCH > size)
+			return;
+		uint32_t hash = hash_at(pos);
+		previous[pos % PNG_WINDOW_SIZE] = head[hash];
+		head[hash] = pos;
+	};
+	auto put_literal = [&](int symbol) { bits.put(codes.literal_codes[symbol], codes.literal_lengths[symbol]); };
+
+	size_t pos = 0;
+	while(pos < size) {
+		int best_length = 0;
+		size_t best_distance = 0;
+		if(pos + PNG_MIN_MATCH <= size) {
+			int max_length = std::min((size_t)PNG_MAX_MATCH, size - pos);
+			int32_t candidate = head[hash_at(pos)];
+			for(int chain = 0; chain < PNG_MAX_CHAIN && candidate >= 0 && pos - candidate <= PNG_WINDOW_SIZE; chain++) {
+				int length = 0;
+				while(length < max_length && bytes[candidate + length] == bytes[pos + length]) length++;
+				if(length > best_length) {
+					best_length = length;
+					best_distance = pos - candidate;
+					if(length == max_length)
+						break;
+				}
+				int32_t next = previous[candidate % PNG_WINDOW_SIZE];
+				// the slot was reused by a newer position
+				if(next >= candidate)
+					break;
+				candidate = next;
+			}
+		}
+
+		if(best_length >= PNG_MIN_MATCH) {
+			put_literal(codes.length_symbols[best_length]);
+			bits.put(best_length - codes.length_bases[best_length], codes.length_extra[best_length]);
+			int distance_code = codes.distance_symbols[best_distance];
+			bits.put(codes.distance_codes[distance_code], 5);
+			bits.put(best_distance - PngFixedCodes::distance_start(distance_code), PngFixedCodes::distance_extra(distance_code));
+			for(int i = 0; i < best_length; i++)
+				insert(pos + i);
+			pos += best_length;
+		}
+		else {
+			put_literal(bytes[pos]);
+			insert(pos);
+			pos++;
+		}
+	}
+	put_literal(256);
+
+	// every stored block costs 5 bytes
+	size_t stored_size = size + (size / 65535 + 1) * 5;
+	if(compressed.size() > stored_size) {
+		compressed.clear();
+		size_t stored = 0;
+		while(stored < size) {
+			size_t block = std::min(size - stored, (size_t)65535);
+			// not final, stored, then the length and its complement
+			compressed += (char)0;
+			compressed += (char)(block & 0xff);
+			compressed += (char)(block >> 8);
+			compressed += (char)(~block & 0xff);
+			compressed += (char)((~block >> 8) & 0xff);
+			compressed.append((const char*)&bytes[stored], block);
+			stored += block;
+		}
+	}
+	else {
+		// empty stored block, aligned to a whole byte
+		bits.put(0b000, 3);
+		bits.align();
+		compressed.append("\x00\x00\xff\xff", 4);
+	}
+	out += compressed;
+}
+
+/**
+ * deflates the scanlines in bands of PNG_BAND_BYTES on up to threads threads,
+ * every band becomes an IDAT chunk appended to chunks. adler is the adler32 of the scanlines
+ */
+inline void png_deflate_scanlines(const uint8_t* scanlines, size_t size, int threads, std::string& chunks, uint32_t& adler) {
+	int bands = std::max((size_t)1, (size + PNG_BAND_BYTES - 1) / PNG_BAND_BYTES);
+	std::vector<std::string> band_chunks(bands);
+	std::vector<uint32_t> band_adlers(bands);
+
+	auto deflate_bands = [&](int first_band, int step) {
+		std::string deflated;
+		for(int band = first_band; band < bands; band += step) {
+			size_t start = band * (size_t)PNG_BAND_BYTES;
+			size_t band_size = std::min(size - start, (size_t)PNG_BAND_BYTES);
+			deflated.clear();
+			png_deflate_band(&scanlines[start], band_size, deflated);
+			png_append_chunk(band_chunks[band], "IDAT", deflated);
+			band_adlers[band] = png_adler32(1, &scanlines[start], band_size);
+		}
+	};
+
+	threads = std::max(1, std::min(threads, bands));
+	std::vector<std::thread> workers;
+	for(int t = 1; t < threads; t++)
+		workers.emplace_back(deflate_bands, t, threads);
+	deflate_bands(0, threads);
+	for(std::thread& worker : workers)
+		worker.join();
+
+	adler = band_adlers[0];
+	for(int band = 1; band < bands; band++) {
+		size_t band_size = std::min(size - band * (size_t)PNG_BAND_BYTES, (size_t)PNG_BAND_BYTES);
+		adler = png_adler32_combine(adler, band_adlers[band], band_size);
+	}
+	for(std::string& chunk : band_chunks)
+		chunks += chunk;
+}
+
+// signature, image header, palette and the IDAT with the zlib header
+inline std::string png_file_header(int rows, int cols, rgb floor_color, rgb wall_color) {
+	std::string header = "\x89PNG\r\n\x1a\n";
+
+	std::string image_header;
+	png_put_u32(image_header, cols);
+	png_put_u32(image_header, rows);
+	// bit depth 1, palette, deflate, no filter, no interlace
+	image_header += std::string("\x01\x03\x00\x00\x00", 5);
+	png_append_chunk(header, "IHDR", image_header);
+
+	std::string palette = {
+		(char)floor_color.r, (char)floor_color.g, (char)floor_color.b,
+		(char)wall_color.r, (char)wall_color.g, (char)wall_color.b
+	};
+	png_append_chunk(header, "PLTE", palette);
+
+	// deflate with a 32K window, default compression
+	png_append_chunk(header, "IDAT", "\x78\x9c");
+	return header;
+}
+
+// IDAT with the final empty block and the adler32 of all the scanlines, then the end
+inline std::string png_file_trailer(uint32_t adler) {
+	std::string trailer;
+	std::string data("\x03\x00", 2);
+	png_put_u32(data, adler);
+	png_append_chunk(trailer, "IDAT", data);
+	png_append_chunk(trailer, "IEND", "");
+	return trailer;
+}
+
+inline int png_default_threads() {
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/**
+ * writes the rows x cols cells as a png, rows are stride cells apart.
+ * returns false if the file can't be written.
+ */
+inline bool write_png(const std::string& path, const uint8_t* cells, int stride, int rows, int cols, rgb floor_color, rgb wall_color,
+	int threads = png_default_threads()) {
+	std::ofstream file(path, std::ios::binary);
+	if(!file.is_open())
+		return false;
+
+	size_t size = (size_t)rows * ((cols + 7) / 8 + 1);
+	uint8_t* scanlines = new uint8_t[size];
+	png_pack_rows(cells, stride, 0, rows, cols, scanlines);
+	std::string chunks;
+	uint32_t adler;
+	png_deflate_scanlines(scanlines, size, threads, chunks, adler);
+	delete[] scanlines;
+
+	std::string header = png_file_header(rows, cols, floor_color, wall_color);
+	std::string trailer = png_file_trailer(adler);
+	file.write(header.data(), header.size());
+	file.write(chunks.data(), chunks.size());
+	file.write(trailer.data(), trailer.size());
+	return file.good();
+}
+
+/**
+ * COLLECTIVE
+ * writes the grid as a png straight from the tiles, it's never gathered on a single process.
+ * the tiles of a row of processes are gathered by the one holding the first column,
+ * which deflates its band of rows on threads threads. the first process of comm places
+ * the bands in the file and combines their adler32.
+ * returns MPI_SUCCESS if the file was written.
+ */
+inline int write_png_file(MPI_Comm comm, const std::string& path, const GridTile& tile, const uint8_t* cells, int stride,
+	rgb floor_color, rgb wall_color, int threads = png_default_threads()) {
+	int rank, n_procs;
+	MPI_Comm_rank(comm, &rank);
+	MPI_Comm_size(comm, &n_procs);
+
+	// processes sharing the same rows, ordered by column
+	MPI_Comm row_comm;
+	MPI_Comm_split(comm, tile.first_row, tile.first_col, &row_comm);
+	int row_rank, row_procs;
+	MPI_Comm_rank(row_comm, &row_rank);
+	MPI_Comm_size(row_comm, &row_procs);
+
+	int tile_size = tile.tile_rows * tile.tile_cols;
+	uint8_t* packed_tile = new uint8_t[tile_size];
+	for(int i = 0; i < tile.tile_rows; i++)
+		std::copy_n(&cells[i * stride], tile.tile_cols, &packed_tile[i * tile.tile_cols]);
+
+	int tile_cols_first_col[2] = { tile.tile_cols, tile.first_col };
+	std::vector<int> row_tiles(2 * row_procs);
+	MPI_Gather(tile_cols_first_col, 2, MPI_INT, row_tiles.data(), 2, MPI_INT, 0, row_comm);
+
+	std::vector<int> counts(row_procs), displs(row_procs);
+	uint8_t* band = nullptr;
+	if(row_rank == 0) {
+		for(int p = 0; p < row_procs; p++) {
+			counts[p] = tile.tile_rows * row_tiles[2 * p];
+			displs[p] = p == 0 ? 0 : displs[p - 1] + counts[p - 1];
+		}
+		band = new uint8_t[displs[row_procs - 1] + counts[row_procs - 1]];
+	}
+	MPI_Gatherv(packed_tile, tile_size, MPI_UINT8_T, band, counts.data(), displs.data(), MPI_UINT8_T, 0, row_comm);
+	delete[] packed_tile;
+
+	// the band of rows, its chunks, adler32 and scanlines size
+	std::string chunks;
+	uint32_t adler = 1;
+	uint64_t scanlines_size = 0;
+	if(row_rank == 0) {
+		uint8_t* band_rows = new uint8_t[(size_t)tile.tile_rows * tile.cols];
+		for(int p = 0; p < row_procs; p++) {
+			for(int i = 0; i < tile.tile_rows; i++)
+				std::copy_n(&band[displs[p] + i * row_tiles[2 * p]], row_tiles[2 * p], &band_rows[i * tile.cols + row_tiles[2 * p + 1]]);
+		}
+		delete[] band;
+
+		scanlines_size = (uint64_t)tile.tile_rows * ((tile.cols + 7) / 8 + 1);
+		uint8_t* scanlines = new uint8_t[scanlines_size];
+		png_pack_rows(band_rows, tile.cols, 0, tile.tile_rows, tile.cols, scanlines);
+		delete[] band_rows;
+		png_deflate_scanlines(scanlines, scanlines_size, threads, chunks, adler);
+		delete[] scanlines;
+	}
+	MPI_Comm_free(&row_comm);
+
+	// the first process places the bands top to bottom after the header
+	std::string header = png_file_header(tile.rows, tile.cols, floor_color, wall_color);
+	uint64_t band_info[4] = { (uint64_t)(row_rank == 0), (uint64_t)tile.first_row, chunks.size(), scanlines_size };
+	uint64_t band_adler = adler;
+	std::vector<uint64_t> all_band_info(rank == 0 ? 4 * n_procs : 0);
+	std::vector<uint64_t> all_adlers(rank == 0 ? n_procs : 0);
+	MPI_Gather(band_info, 4, MPI_UINT64_T, all_band_info.data(), 4, MPI_UINT64_T, 0, comm);
+	MPI_Gather(&band_adler, 1, MPI_UINT64_T, all_adlers.data(), 1, MPI_UINT64_T, 0, comm);
+
+	std::vector<uint64_t> offsets(rank == 0 ? n_procs : 0);
+	uint64_t end_offset = 0;
+	uint32_t file_adler = 1;
+	if(rank == 0) {
+		std::vector<int> leaders;
+		for(int p = 0; p < n_procs; p++)
+			if(all_band_info[4 * p])
+				leaders.push_back(p);
+		std::sort(leaders.begin(), leaders.end(), [&](int a, int b) { return all_band_info[4 * a + 1] < all_band_info[4 * b + 1]; });
+
+		uint64_t offset = header.size();
+		for(int p : leaders) {
+			offsets[p] = offset;
+			offset += all_band_info[4 * p + 2];
+			file_adler = png_adler32_combine(file_adler, all_adlers[p], all_band_info[4 * p + 3]);
+		}
+		end_offset = offset;
+	}
+	uint64_t my_offset;
+	MPI_Scatter(offsets.data(), 1, MPI_UINT64_T, &my_offset, 1, MPI_UINT64_T, 0, comm);
+
+	MPI_File file;
+	int err = MPI_File_open(comm, path.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file);
+	if(err != MPI_SUCCESS)
+		return err;
+	// an older and bigger file would keep its tail
+	MPI_File_set_size(file, 0);
+
+	int is_failed = 0;
+	if(!chunks.empty())
+		is_failed |= MPI_File_write_at(file, my_offset, chunks.data(), chunks.size(), MPI_BYTE, MPI_STATUS_IGNORE) != MPI_SUCCESS;
+	if(rank == 0) {
+		std::string trailer = png_file_trailer(file_adler);
+		is_failed |= MPI_File_write_at(file, 0, header.data(), header.size(), MPI_BYTE, MPI_STATUS_IGNORE) != MPI_SUCCESS;
+		is_failed |= MPI_File_write_at(file, end_offset, trailer.data(), trailer.size(), MPI_BYTE, MPI_STATUS_IGNORE) != MPI_SUCCESS;
+	}
+	MPI_Allreduce(MPI_IN_PLACE, &is_failed, 1, MPI_INT, MPI_LOR, comm);
+	MPI_File_close(&file);
+	return is_failed ? MPI_ERR_IO : MPI_SUCCESS;
+}
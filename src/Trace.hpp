@@ -0,0 +1,140 @@
+#pragma once
+
+#include <mpi.h>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+
+/**
+ * timeline of what every process did, written as a chrome trace (chrome://tracing, ui.perfetto.dev)
+ * with one track per process.
+ * events go in a buffer allocated before the run, once it's full the rest are only counted
+ */
+enum TracePhase {
+	TRACE_SEND_COLUMNS, TRACE_SEND_ROWS, TRACE_SEND_CORNERS,
+	TRACE_RECEIVE_COLUMNS, TRACE_RECEIVE_ROWS, TRACE_RECEIVE_CORNERS,
+	TRACE_UPDATE, TRACE_GATHER, TRACE_DRAW, TRACE_CHECKPOINT, TRACE_RECORD,
+	TRACE_PHASES
+};
+
+inline const char* trace_phase_name(int phase) {
+	static const char* names[TRACE_PHASES] = {
+		"send columns", "send rows", "send corners",
+		"receive columns", "receive rows", "receive corners",
+		"update", "gather", "draw", "checkpoint", "record"
+	};
+	return names[phase];
+}
+
+inline const char* trace_phase_category(int phase) {
+	if(phase <= TRACE_RECEIVE_CORNERS)
+		return "halo";
+	if(phase == TRACE_UPDATE)
+		return "compute";
+	return "io";
+}
+
+struct TraceEvent
+{
+	int32_t phase;
+	int32_t generation;
+	double begin;
+	double end;
+};
+
+class Tracer
+{
+public:
+	bool is_enabled() const { return capacity > 0; }
+
+	// times are taken from origin, which should be the same moment on every process
+	void allocate(size_t capacity, double origin) {
+		events.resize(capacity);
+		this->capacity = capacity;
+		this->origin = origin;
+	}
+
+	void add(TracePhase phase, int generation, double begin, double end) {
+		if(count == capacity) {
+			dropped++;
+			return;
+		}
+		events[count++] = { phase, generation, begin - origin, end - origin };
+	}
+
+	/**
+	 * COLLECTIVE
+	 * root gathers the events of every process of comm and writes them to path.
+	 * returns false on root if the file can't be written
+	 */
+	bool write(MPI_Comm comm, const std::string& path, int root) {
+		int rank, n_procs;
+		MPI_Comm_rank(comm, &rank);
+		MPI_Comm_size(comm, &n_procs);
+
+		// counted in events, in bytes the displacements of a few hundred processes overflow an int
+		MPI_Datatype event_type;
+		MPI_Type_contiguous(sizeof(TraceEvent), MPI_BYTE, &event_type);
+		MPI_Type_commit(&event_type);
+
+		int my_count = count;
+		long long my_dropped = dropped;
+		std::vector<int> counts(rank == root ? n_procs : 0), displs(rank == root ? n_procs : 0);
+		std::vector<long long> all_dropped(rank == root ? n_procs : 0);
+		MPI_Gather(&my_count, 1, MPI_INT, counts.data(), 1, MPI_INT, root, comm);
+		MPI_Gather(&my_dropped, 1, MPI_LONG_LONG, all_dropped.data(), 1, MPI_LONG_LONG, root, comm);
+
+		std::vector<TraceEvent> all_events;
+		if(rank == root) {
+			int total = 0;
+			for(int p = 0; p < n_procs; p++) {
+				displs[p] = total;
+				total += counts[p];
+			}
+			all_events.resize(total);
+		}
+		MPI_Gatherv(events.data(), my_count, event_type, all_events.data(), counts.data(), displs.data(), event_type, root, comm);
+		MPI_Type_free(&event_type);
+		if(rank != root)
+			return true;
+
+		std::ofstream file(path);
+		if(!file.is_open())
+			return false;
+		// microseconds, down to the nanosecond
+		file << std::fixed << std::setprecision(3);
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+		bool is_first = true;
+		for(int p = 0; p < n_procs; p++) {
+			if(!is_first)
+				file << "," << std::endl;
+			is_first = false;
+			file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << p
+				<< ",\"args\":{\"name\":\"rank " << p << "\",\"dropped_events\":" << all_dropped[p] << "}}";
+
+			for(int e = 0; e < counts[p]; e++) {
+				const TraceEvent& event = all_events[displs[p] + e];
+				file << "," << std::endl << "{\"name\":\"" << trace_phase_name(event.phase)
+					<< "\",\"cat\":\"" << trace_phase_category(event.phase)
+					<< "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << p
+					<< ",\"ts\":" << event.begin * 1e6
+					<< ",\"dur\":" << (event.end - event.begin) * 1e6
+					<< ",\"args\":{\"generation\":" << event.generation << "}}";
+			}
+		}
+		file << std::endl << "]}" << std::endl;
+		return file.good();
+	}
+
+	size_t dropped_events() const { return dropped; }
+
+private:
+	std::vector<TraceEvent> events;
+	size_t capacity = 0;
+	size_t count = 0;
+	size_t dropped = 0;
+	double origin = 0;
+};
@@ -0,0 +1,205 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Kernel.hpp"
+
+
+/**
+ * times the cell kernels of Kernel.hpp on their own, without MPI or Allegro,
+ * over every combination of grid size, radius, roughness and fill percentage.
+ * every kernel is checked against update_cells first.
+ * GB/s counts the bytes a generation has to move at least: the whole read grid once and the inner cells written
+ */
+
+enum KernelVariant { KERNEL_REFERENCE, KERNEL_BRANCHLESS, KERNEL_SLIDING, KERNEL_VARIANTS };
+
+const char* kernel_names[KERNEL_VARIANTS] = { "reference", "branchless", "sliding" };
+
+struct KernelCase {
+	int size, radius, roughness, fill;
+};
+
+std::vector<int> sizes = { 64, 512, 4096 };
+std::vector<int> radii = { 1, 2, 3, 4, 5, 6, 7, 8 };
+std::vector<int> roughnesses = { 0, 1, 3 };
+std::vector<int> fills = { 35, 51, 65 };
+// each kernel runs generations until this many seconds pass
+double min_seconds = 0.2;
+std::string results_file_path;
+
+
+void run_kernel(int variant, const KernelCase& kernel_case, const uint8_t* read_grid, uint8_t* write_grid, int* column_walls) {
+	int side = kernel_case.size + 2 * kernel_case.radius;
+	switch(variant) {
+	case KERNEL_REFERENCE:
+		update_cells(read_grid, write_grid, side, side, kernel_case.radius, kernel_case.roughness);
+		break;
+	case KERNEL_BRANCHLESS:
+		update_cells_branchless(read_grid, write_grid, side, side, kernel_case.radius, kernel_case.roughness);
+		break;
+	case KERNEL_SLIDING:
+		update_cells_sliding(read_grid, write_grid, side, side, kernel_case.radius, kernel_case.roughness, column_walls);
+		break;
+	}
+}
+
+// walls all around like in cavegen, random inside
+std::vector<uint8_t> initial_grid(const KernelCase& kernel_case) {
+	int side = kernel_case.size + 2 * kernel_case.radius;
+	std::vector<uint8_t> grid(side * side, 1);
+	std::mt19937 random(kernel_case.size * 1000 + kernel_case.fill);
+	std::uniform_int_distribution<int> percent(0, 99);
+	for(int i = kernel_case.radius; i < side - kernel_case.radius; i++)
+		for(int j = kernel_case.radius; j < side - kernel_case.radius; j++)
+			grid[i * side + j] = percent(random) < kernel_case.fill;
+	return grid;
+}
+
+// a few generations of the variant and of the reference from the same grid must end the same
+bool verify_kernel(int variant, const KernelCase& kernel_case, const std::vector<uint8_t>& initial, int* column_walls) {
+	const int generations = 3;
+	std::vector<uint8_t> expected[2] = { initial, initial }, actual[2] = { initial, initial };
+	for(int g = 0; g < generations; g++) {
+		run_kernel(KERNEL_REFERENCE, kernel_case, expected[g % 2].data(), expected[(g + 1) % 2].data(), column_walls);
+		run_kernel(variant, kernel_case, actual[g % 2].data(), actual[(g + 1) % 2].data(), column_walls);
+	}
+	return expected[generations % 2] == actual[generations % 2];
+}
+
+// seconds per generation, generations ping pong between the two grids
+double time_kernel(int variant, const KernelCase& kernel_case, const std::vector<uint8_t>& initial, int* column_walls) {
+	std::vector<uint8_t> grids[2] = { initial, initial };
+	// warm up the caches and the branch predictor
+	run_kernel(variant, kernel_case, grids[0].data(), grids[1].data(), column_walls);
+
+	// at least one generation, however short min_seconds is
+	int generations = 0;
+	double seconds = 0;
+	auto start = std::chrono::steady_clock::now();
+	do {
+		run_kernel(variant, kernel_case, grids[generations % 2].data(), grids[(generations + 1) % 2].data(), column_walls);
+		generations++;
+		seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	} while(seconds < min_seconds);
+	return seconds / generations;
+}
+
+std::vector<int> parse_list(const std::string& list) {
+	std::vector<int> values;
+	std::stringstream stream(list);
+	std::string value;
+	while(std::getline(stream, value, ','))
+		values.push_back(std::stoi(value));
+	return values;
+}
+
+void print_help() {
+	std::cout << "Usage: kernel_bench [options]" << std::endl
+		<< "-sizes <int,...>: Inner side of the square grids (default 64,512,4096)" << std::endl
+		<< "-radii <int,...>: Neighbour radii (default 1 to 8)" << std::endl
+		<< "-roughness <int,...>: Roughness values (default 0,1,3)" << std::endl
+		<< "-fill <int,...>: Initial fill percentages (default 35,51,65)" << std::endl
+		<< "-min-time <seconds>: Time every kernel runs for at least (default 0.2)" << std::endl
+		<< "-o <path>: CSV file with a row per kernel and case" << std::endl;
+}
+
+bool get_args(int argc, char const* argv[]) {
+	for(int i = 1; i < argc; i++) {
+		if(argv[i] == std::string("-h") || argv[i] == std::string("--help")) {
+			print_help();
+			std::exit(0);
+		}
+		else if(argv[i] == std::string("-sizes") && i + 1 < argc)
+			sizes = parse_list(argv[++i]);
+		else if(argv[i] == std::string("-radii") && i + 1 < argc)
+			radii = parse_list(argv[++i]);
+		else if(argv[i] == std::string("-roughness") && i + 1 < argc)
+			roughnesses = parse_list(argv[++i]);
+		else if(argv[i] == std::string("-fill") && i + 1 < argc)
+			fills = parse_list(argv[++i]);
+		else if(argv[i] == std::string("-min-time") && i + 1 < argc)
+			min_seconds = std::stod(argv[++i]);
+		else if(argv[i] == std::string("-o") && i + 1 < argc)
+			results_file_path = argv[++i];
+		else {
+			std::cout << "Unknown option " << argv[i] << std::endl;
+			print_help();
+			return false;
+		}
+	}
+	if(min_seconds <= 0) {
+		std::cout << "-min-time must be more than 0 seconds" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char const* argv[]) {
+	if(!get_args(argc, argv))
+		return 1;
+
+	std::ofstream file;
+	if(!results_file_path.empty()) {
+		file.open(results_file_path);
+		if(!file.is_open()) {
+			std::cout << "Failed to open " << results_file_path << std::endl;
+			return 1;
+		}
+		file << "kernel,size,radius,roughness,fill,grid_bytes,ns_per_cell,gb_per_second,verified" << std::endl;
+	}
+
+	std::cout << std::setw(6) << "size" << std::setw(8) << "radius" << std::setw(7) << "rough" << std::setw(6) << "fill"
+		<< std::setw(12) << "kernel" << std::setw(10) << "ns/cell" << std::setw(8) << "GB/s" << std::setw(10) << "speedup"
+		<< std::setw(8) << "check" << std::endl;
+	std::cout << std::fixed;
+
+	bool is_every_kernel_right = true;
+	for(int size : sizes) {
+		for(int radius : radii) {
+			for(int roughness : roughnesses) {
+				for(int fill : fills) {
+					KernelCase kernel_case = { size, radius, roughness, fill };
+					std::vector<uint8_t> initial = initial_grid(kernel_case);
+					std::vector<int> column_walls(size + 2 * radius);
+					double cells = (double)size * size;
+					double bytes = (double)initial.size() + cells;
+
+					double reference_seconds = 0;
+					for(int variant = 0; variant < KERNEL_VARIANTS; variant++) {
+						bool is_right = variant == KERNEL_REFERENCE || verify_kernel(variant, kernel_case, initial, column_walls.data());
+						is_every_kernel_right = is_every_kernel_right && is_right;
+						double seconds = time_kernel(variant, kernel_case, initial, column_walls.data());
+						if(variant == KERNEL_REFERENCE)
+							reference_seconds = seconds;
+
+						double ns_per_cell = seconds * 1e9 / cells;
+						double gb_per_second = bytes / seconds / 1e9;
+						std::cout << std::setw(6) << size << std::setw(8) << radius << std::setw(7) << roughness << std::setw(6) << fill
+							<< std::setw(12) << kernel_names[variant] << std::setw(10) << std::setprecision(3) << ns_per_cell
+							<< std::setw(8) << std::setprecision(2) << gb_per_second
+							<< std::setw(10) << std::setprecision(2) << reference_seconds / seconds
+							<< std::setw(8) << (is_right ? "ok" : "WRONG") << std::endl;
+						if(file.is_open()) {
+							file << kernel_names[variant] << "," << size << "," << radius << "," << roughness << "," << fill << ","
+								<< initial.size() << "," << ns_per_cell << "," << gb_per_second << "," << is_right << std::endl;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	if(!is_every_kernel_right) {
+		std::cout << "Some kernels don't match the reference" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -1,7 +1,10 @@
 #include <chrono>
 #include <iostream>
+#include <iomanip>
 #include <time.h>
 #include <string>
+#include <vector>
+#include <sstream>
 
 #include <allegro5/allegro.h>
 #include <allegro5/allegro_font.h>
@@ -10,16 +13,37 @@
 #include <algorithm>
 #include <mpi.h>
 #include <random>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <sys/resource.h>
 #include "Config.hpp"
+#include "FrameQueue.hpp"
+#include "GridIO.hpp"
+#include "Checkpoint.hpp"
+#include "Png.hpp"
+#include "Gif.hpp"
+#include "CaveRecord.hpp"
+#include "History.hpp"
+#include "Latency.hpp"
+#include "Trace.hpp"
+#include "PerfCounters.hpp"
+#include "MpiProfiler.hpp"
+#include "Bench.hpp"
+#include "Kernel.hpp"
 
 #define ROOT_RANK 0
 
 Config* cfg;
 std::string config_file_path = "./config/default.cfg";
+// recording played back instead of running the simulation
+std::string play_file_path;
 
 uint8_t* write_grid;
 uint8_t* read_grid;
-uint8_t* root_grid; // full grid used for drawing
+uint8_t* root_grid; // full row-major grid used for the initial scatter
 
 
 /**
@@ -39,41 +63,121 @@ uint8_t* root_grid; // full grid used for drawing
  */
 int radius;
 
-// maxiumum number of wall neightbours around any cell
-int max_neighbours;
-// half the maximun number of wall neighbours around any cell
-int half_neighbours;
-
 int my_rank = 0; // MPI rank
 int n_procs = 1; // MPI size
 
 int my_rows, my_inner_rows, tot_inner_rows;
 int my_cols, my_inner_cols, tot_inner_cols;
 
+// position of my first inner cell in the whole grid
+int my_first_row = 0, my_first_col = 0;
+
 int inner_grid_size;
 int outer_grid_size;
 
 int generation = 0;
 bool is_running = true;
 
+// GRAPHIC ONLY
+// generations run between two frames
+int generations_per_frame = 1;
+// ROOT ONLY, moving average of the time taken by a generation, to adapt generations_per_frame
+double seconds_per_generation = 0;
+// limits generations_per_frame when a generation takes almost no time
+#define MAX_GENERATIONS_PER_FRAME 65536
+// fraction of the time between two frames the generations may take
+#define FRAME_BUDGET_USAGE 0.9
+
 double total_time = 0;
 double communication_time = 0;
 double generation_time = 0;
 double draw_time = 0;
+double save_time = 0;
+double checkpoint_time = 0;
+double record_time = 0;
+
+// file the first generation is loaded from, set by -load or --restart
+std::string load_path;
+GridFileInfo load_file_info;
 double start_time, end_time;
-// double* frame_times;
+// generation the run started from, a restart doesn't start from 0
+int first_generation = 0;
+
+// COMPUTING PROCESSES ONLY
+// time of every generation for each phase, the recap shows their percentiles
+LatencySamples halo_latency;
+LatencySamples update_latency;
+LatencySamples generation_latency;
+// ROOT ONLY, slowest process in every generation
+LatencySummary halo_summary, update_summary, generation_summary;
+
+// TRACING ONLY
+// most events a process keeps, about 24 MB
+#define TRACE_MAX_EVENTS (1 << 20)
+// events traced in a generation at most: every phase once (the halo exchange, update, checkpoint, record,
+// the gather and draw of a frame when every generation is shown) and a second gather for the record
+#define TRACE_EVENTS_PER_GENERATION (TRACE_PHASES + 1)
+Tracer tracer;
+
+// PERF COUNTERS ONLY
+PerfCounters perf_counters;
+PerfPhase perf_update, perf_halo, perf_draw;
+// ROOT ONLY, sums over every process, -1 for the counters no process could open
+double perf_totals[3][PERF_COUNTERS];
+
+// ROOT ONLY, how a phase time is spread over the computing processes
+struct PhaseBalance {
+	double min, avg, max;
+	// rank in cave_comm of the slowest process
+	int max_rank;
+	// max / avg, 1 when every process takes the same time
+	double imbalance;
+};
+PhaseBalance communication_balance, generation_balance, draw_balance;
+// ROOT ONLY, peak resident memory of the computing processes in KB
+PhaseBalance peak_rss_balance;
+
+// ROOT ONLY, throughput of the run
+double cell_updates_per_second = 0;
+// every process, both directions
+double halo_bytes = 0;
+// halo_bytes over the average communication time, the rate while exchanging
+double halo_bytes_per_second = 0;
+// against the fastest serial run of the same cave in the results file, 0 if there's none
+double speedup = 0;
+double efficiency = 0;
+// ROOT ONLY, generation_time of every computing process
+std::vector<double> process_generation_times;
 
 
 
 int neighbours_ranks[3][3];
 
 MPI_Datatype inner_grid_t;
-MPI_Datatype contiguous_grid_t;
+// one tile inside the full row-major grid, resized so tiles can be placed a tile width apart
+MPI_Datatype global_tile_t;
+// ROOT AND DISPLAY PROCESS ONLY
+// where each process tile goes in the full grid, in tile widths
+int* tile_counts;
+int* tile_displs;
 MPI_Datatype column_t; // for sending/receiving left and right columns
 MPI_Datatype row_t; // for sending/receiving top and bottom rows
 MPI_Datatype corner_t; // for sending/receiving corners
 MPI_Comm cave_comm;
 
+// the processes computing the grid, all of them unless render_rank is set
+MPI_Comm compute_comm;
+bool is_computing_process = true;
+
+// GRAPHIC ONLY
+// the process showing the grid: root, or the extra last process if render_rank is set.
+// frames are gathered on display_rank of display_comm
+bool is_display_process = false;
+MPI_Comm display_comm;
+int display_rank = ROOT_RANK;
+// tag of the generations time root sends to the display process
+#define GENERATIONS_TIME_TAG 2001
+
 
 
 ALLEGRO_FONT* font;
@@ -86,6 +190,131 @@ int DISPLAY_WIDTH, DISPLAY_HEIGHT;
 
 ALLEGRO_COLOR threads_grid_color;
 
+// the grid is drawn at one pixel per displayed cell, then scaled to the display
+ALLEGRO_BITMAP* grid_bitmap;
+int grid_bitmap_width, grid_bitmap_height;
+uint32_t wall_pixel, floor_pixel;
+
+// threads grid is drawn once for each view
+ALLEGRO_BITMAP* threads_grid_bitmap;
+int threads_grid_view[3] = { -1, -1, -1 };
+
+// cells currently in grid_bitmap, only the rows that differ from these get redrawn
+uint8_t* displayed_grid;
+// rows of grid_bitmap checked and redrawn together
+#define DIRTY_BAND_ROWS 16
+// set when the display has to be redrawn even if no cell changed
+bool force_redraw = true;
+
+
+// GRAPHIC ONLY
+// above this many displayed cells the grid is shown with a lower level of detail
+#define MAX_GRAPHIC_CELLS 1382400
+
+// side of the block of cells summarized by one displayed cell, 1 means full resolution
+int lod_block = 1;
+// lod_block when the whole grid is in view, the view can't zoom out further
+int max_lod_block = 1;
+// size in blocks of the displayed grid
+int view_rows, view_cols;
+// first cell in view, the view covers view_rows * lod_block rows and view_cols * lod_block cols
+int view_first_row = 0, view_first_col = 0;
+
+// blocks in view touched by my tile
+int my_first_block_row, my_first_block_col;
+int my_block_rows, my_block_cols;
+
+uint16_t* lod_tile; // walls in each block touched by my tile
+uint16_t* lod_root_tiles; // ROOT ONLY, lod_tile of every process
+int lod_root_tiles_size; // ROOT ONLY
+uint32_t* lod_walls; // ROOT ONLY, walls in each displayed block
+int* lod_counts; // ROOT ONLY, size of every process lod_tile
+int* lod_displs; // ROOT ONLY, offset of every process lod_tile in lod_root_tiles
+
+// ROOT ONLY, pixel of a displayed block for each wall density
+uint32_t lod_pixels[256];
+
+struct View { int first_row, first_col, lod_block; };
+
+// ROOT ONLY
+// view moved by the user in the render thread, the main thread applies it at the next frame
+View ui_view;
+View requested_view;
+std::mutex view_mutex;
+
+// ROOT ONLY, view dragging with the mouse
+bool is_dragging_view = false;
+int drag_start_x, drag_start_y;
+int drag_start_row, drag_start_col;
+
+
+// GRAPHIC ONLY, ROOT ONLY
+// the main thread gathers frames and a render thread draws them,
+// frames go back and forth between the two threads through a pair of queues
+struct Frame {
+	// full grid as gathered, or wall density of each block in level of detail
+	uint8_t* cells;
+	// view the frame was taken with
+	View view;
+	int generation;
+};
+#define FRAME_POOL_SIZE 3
+Frame frame_pool[FRAME_POOL_SIZE];
+FrameQueue<Frame*> ready_frames(FRAME_POOL_SIZE); // main thread -> render thread
+FrameQueue<Frame*> free_frames(FRAME_POOL_SIZE); // render thread -> main thread
+
+std::thread render_thread;
+std::atomic<bool> is_rendering{ true };
+std::atomic<bool> quit_requested{ false };
+double render_time = 0; // written by the render thread only
+
+// the render thread asks for a new frame on every timer tick
+bool is_frame_wanted = true;
+std::mutex frame_wanted_mutex;
+std::condition_variable frame_wanted_cv;
+// the user paused the simulation, the main thread waits until it's resumed or stepped
+bool is_paused = false;
+int pending_steps = 0;
+
+
+// GRAPHIC ONLY, ROOT ONLY, RENDER THREAD ONLY
+// frames already shown, so they can be shown again while paused
+struct FrameInfo {
+	View view;
+	int generation;
+};
+// frames between two keyframes of the history, going back one frame decodes at most this many deltas
+#define HISTORY_KEYFRAME_INTERVAL 64
+// frames a page up/down moves through the history
+#define HISTORY_PAGE_FRAMES 10
+FrameHistory<FrameInfo> frame_history;
+// frame of the history on display, 0 is the newest
+int history_frames_back = 0;
+Frame history_frame;
+
+
+// RECORDING ONLY, ROOT ONLY
+// the main thread gathers every record_interval-th generation and a record thread encodes and writes it.
+// the pool bounds the memory, the main thread only waits if the record thread falls behind by all of it
+struct RecordFrame {
+	// full row-major grid
+	uint8_t* cells;
+	int generation;
+};
+#define RECORD_POOL_SIZE 8
+uint8_t* record_pool[RECORD_POOL_SIZE];
+FrameQueue<RecordFrame> ready_records(RECORD_POOL_SIZE); // main thread -> record thread
+FrameQueue<uint8_t*> free_records(RECORD_POOL_SIZE); // record thread -> main thread
+
+std::thread record_thread;
+// both threads wait on record_cv for the other one
+std::mutex record_mutex;
+std::condition_variable record_cv;
+bool is_recording = false;
+std::atomic<bool> record_failed{ false };
+GifWriter gif_writer;
+CaveRecordWriter cave_writer;
+
 
 inline int at(int y, int x) {
 	return y * my_cols + x;
@@ -108,20 +337,71 @@ inline bool isCoordsEqual(int coords1[], int coords2[]) {
 	return coords1[0] == coords2[0] && coords1[1] == coords2[1];
 }
 
+inline int ceil_div(int a, int b) {
+	return (a + b - 1) / b;
+}
+
+/**
+ * records the phase from begin until now if tracing, and returns now so the next phase can start from it
+ * costs nothing when not tracing
+ */
+inline double trace(TracePhase phase, double begin) {
+	if(!tracer.is_enabled())
+		return begin;
+	double end = MPI_Wtime();
+	tracer.add(phase, generation, begin, end);
+	return end;
+}
+
+// pixels are written as ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, red is the lowest byte
+inline uint32_t to_pixel(rgb color) {
+	return 0xff000000u | (color.b << 16) | (color.g << 8) | color.r;
+}
+
 void initialize(int argc, char const* argv[]);
 void serial_initialize_random_grid();
 void terminate();
 void frame_update();
+void draw_frame(Frame* frame);
+void generation_update();
+void count_generation();
 void update_grid();
 void flip_grid();
 void check_generic_settings();
 void no_graphic_loop();
 
-void write_header(std::ofstream& file);
+GridTile my_grid_tile();
+void check_save_settings();
+void save_grid();
+void load_grid_header();
+void load_grid();
+uint64_t get_config_hash();
+void check_checkpoint_settings();
+void load_checkpoint_header();
+void write_checkpoint();
+void gather_whole_grid(uint8_t* dest_grid);
+
+// recording only
+void check_record_settings();
+void start_recording();
+void record_generation();
+void stop_recording();
+
+void write_header(std::ostream& file);
+void check_results_settings();
 void write_result(std::ofstream& file);
 void end_recap();
+void start_tracing();
+void start_perf_counters();
+void write_trace();
+void check_bench_settings();
+void run_bench();
+void auto_decompose();
 
 void get_config_file_path(int argc, char const* argv[]);
+void read_config();
+bool get_play_file_path(int argc, char const* argv[]);
+int playback(int argc, char const* argv[]);
 void get_arg_configs(int argc, char const* argv[]);
 
 void print_help();
@@ -129,20 +409,37 @@ void print_config_help();
 
 // graphic only
 void graphic_initialize();
-void serial_draw_grid();
+void create_display();
+void destroy_display();
+bool full_draw_grid(const uint8_t* cells);
 void check_graphic_settings();
 void graphic_serial_loop();
 void graphic_parallel_loop();
+void present_grid(const Frame* frame, bool grid_changed);
+void redraw_display();
+void start_render_thread();
+void stop_render_thread();
+
+// level of detail only
+void lod_initialize();
+void broadcast_frame_command(bool& has_frame);
+void lod_count_walls();
+void gather_lod_grid();
+bool handle_view_event(const ALLEGRO_EVENT& event);
+void lod_build_view(uint8_t* view_cells);
+bool lod_draw_grid(const uint8_t* view_cells);
 
 // parallel only
-void parallel_draw_grid();
 void parallel_initialize_random_grid();
 void parallel_initialize();
+void create_cave_topology(MPI_Comm comm);
+void free_cave_topology();
 void check_parallel_settings();
 
 void scatter_initial_grid();
-void gather_grid();
+void gather_grid(uint8_t* dest_grid);
 
+int halo_bytes_per_generation();
 void send_columns();
 void send_rows();
 void send_corners();
@@ -152,6 +449,7 @@ void receive_rows();
 void receive_corners();
 
 inline void exit();
+inline void exit_after_help();
 
 
 /*
@@ -164,9 +462,31 @@ inline void exit();
 
 int main(int argc, char const* argv[])
 {
+	// a recording is played back without MPI
+	if(get_play_file_path(argc, argv))
+		return playback(argc, argv);
+
 	initialize(argc, argv);
 
+	if(cfg->bench) {
+		run_bench();
+		MPI_Finalize();
+		delete cfg;
+		return 0;
+	}
+
+	if(!cfg->trace_file_path.empty())
+		start_tracing();
+	if(cfg->perf_counters)
+		start_perf_counters();
+	if(!cfg->mpi_profile_file_path.empty())
+		mpi_profiler_start(cfg->mpi_profile_file_path);
+
 	start_time = MPI_Wtime();
+	first_generation = generation;
+
+	if(!cfg->record_path.empty())
+		start_recording();
 
 	if(cfg->show_graphics) {
 		if(cfg->is_parallel)
@@ -175,11 +495,20 @@ int main(int argc, char const* argv[])
 	}
 	else no_graphic_loop();
 
+	if(!cfg->record_path.empty())
+		stop_recording();
+
 	end_time = MPI_Wtime();
 	total_time = end_time - start_time;
 
+	if(!cfg->save_file_path.empty())
+		save_grid();
+
 	end_recap();
 
+	if(!cfg->trace_file_path.empty())
+		write_trace();
+
 	terminate();
 	return 0;
 }
@@ -197,20 +526,46 @@ int main(int argc, char const* argv[])
  */
 
 void initialize(int argc, char const* argv[]) {
+	// only the main thread makes MPI calls, root also has a render thread in graphic mode
+	int thread_support;
+	MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &thread_support);
+
 	get_config_file_path(argc, argv);
 
-	cfg = new Config(config_file_path);
+	read_config();
 	get_arg_configs(argc, argv);
 
+	// the render and record threads run next to the one making MPI calls
+	if(thread_support < MPI_THREAD_FUNNELED && (cfg->show_graphics || !cfg->record_path.empty())) {
+		std::cout << "This MPI library doesn't support threads (MPI_THREAD_FUNNELED)" << std::endl;
+		std::cout << "graphic mode and recording need them, run with -G and without -record" << std::endl;
+		exit();
+	}
+
+	// the sweep sets up every case by itself
+	if(cfg->bench) {
+		check_bench_settings();
+		return;
+	}
+
+	if(!cfg->load_file_path.empty())
+		load_grid_header();
+	if(cfg->restart)
+		load_checkpoint_header();
+	if(cfg->auto_decompose && cfg->is_parallel)
+		auto_decompose();
 
 	tot_inner_rows = cfg->rows;
 	tot_inner_cols = cfg->cols;
 	radius = cfg->neighbour_radius;
-	max_neighbours = (radius * (radius + 1) * 4);
-	half_neighbours = max_neighbours / 2;
-
 
-	// frame_times = new double[cfg->last_generation];
+	// generations left to run, at most latency_samples, longer and unbounded runs keep the latest ones
+	size_t latency_capacity = std::max(1, cfg->latency_samples);
+	if(cfg->last_generation > generation)
+		latency_capacity = std::min(latency_capacity, (size_t)(cfg->last_generation - generation));
+	halo_latency.allocate(latency_capacity);
+	update_latency.allocate(latency_capacity);
+	generation_latency.allocate(latency_capacity);
 
 	// checkGeneralSettings();
 
@@ -228,20 +583,35 @@ void initialize(int argc, char const* argv[]) {
 	inner_grid_size = my_inner_rows * my_inner_cols;
 	outer_grid_size = my_rows * my_cols;
 
-	MPI_Init(NULL, NULL);
 	if(cfg->is_parallel)
 		parallel_initialize();
+	else is_display_process = true;
+
+	if(!cfg->save_file_path.empty())
+		check_save_settings();
+	if(!cfg->results_file_path.empty() && my_rank == ROOT_RANK)
+		check_results_settings();
+	if(!cfg->record_path.empty())
+		check_record_settings();
+	if(cfg->checkpoint_interval > 0)
+		check_checkpoint_settings();
 
 	if(cfg->show_graphics)
 		graphic_initialize();
 
+	// the display process of render_rank has no tile
+	if(!is_computing_process)
+		return;
+
 	// create grid and set to 1 every element
 	write_grid = new uint8_t[outer_grid_size];
 	read_grid = new uint8_t[outer_grid_size];
 	std::fill_n(read_grid, outer_grid_size, 1);
 
 
-	if(cfg->is_parallel) {
+	if(!load_path.empty())
+		load_grid();
+	else if(cfg->is_parallel) {
 		if(my_rank == ROOT_RANK) {
 			parallel_initialize_random_grid();
 		}
@@ -254,44 +624,366 @@ void initialize(int argc, char const* argv[]) {
 }
 
 void graphic_initialize() {
-	if(my_rank == ROOT_RANK) {
+	lod_initialize();
+	if(cfg->generations_per_frame > 0)
+		generations_per_frame = cfg->generations_per_frame;
+
+	if(is_display_process) {
 		check_graphic_settings();
-		DISPLAY_WIDTH = cfg->cols * cfg->cell_width;
-		DISPLAY_HEIGHT = cfg->rows * cfg->cell_height;
-		if(cfg->draw_edges) {
+		DISPLAY_WIDTH = view_cols * cfg->cell_width;
+		DISPLAY_HEIGHT = view_rows * cfg->cell_height;
+		if(cfg->draw_edges && lod_block == 1) {
 			DISPLAY_WIDTH += 2 * radius * cfg->cell_width;
 			DISPLAY_HEIGHT += 2 * radius * cfg->cell_height;
 		}
 
-		wall_color = al_map_rgb(cfg->wall_color.r, cfg->wall_color.g, cfg->wall_color.b);
-		floor_color = al_map_rgb(cfg->floor_color.r, cfg->floor_color.g, cfg->floor_color.b);
-		threads_grid_color = al_map_rgb(cfg->threads_grid_color.r, cfg->threads_grid_color.g, cfg->threads_grid_color.b);
-		if(!al_init()) fprintf(stderr, "Failed to initialize allegro.\n");
-		if(!al_install_keyboard()) fprintf(stderr, "Failed to install keyboard.\n");
-		if(!al_init_font_addon()) fprintf(stderr, "Failed to initialize font addon.\n");
-		if(!al_init_ttf_addon()) fprintf(stderr, "Failed to initialize ttf addon.\n");
-		if(!al_init_primitives_addon()) fprintf(stderr, "Failed to initialize primitives addon.\n");
+		create_display();
+
+		if(cfg->is_parallel && cfg->draw_threads_grid) {
+			threads_grid_bitmap = al_create_bitmap(DISPLAY_WIDTH, DISPLAY_HEIGHT);
+			if(!threads_grid_bitmap) fprintf(stderr, "Failed to create threads grid bitmap.\n");
+		}
+		al_set_target_backbuffer(display);
+
+		ui_view = requested_view = { 0, 0, max_lod_block };
+
+		// large enough for the full grid, or for the view in level of detail
+		int frame_size = max_lod_block > 1 ? view_rows * view_cols : tot_inner_rows * tot_inner_cols;
+		for(int i = 0; i < FRAME_POOL_SIZE; i++) {
+			frame_pool[i].cells = new uint8_t[frame_size];
+			free_frames.push(&frame_pool[i]);
+		}
+
+		// densities don't fit in a bit
+		if(max_lod_block > 1)
+			frame_history.initialize(view_rows, view_cols, false, (size_t)cfg->history_memory << 20, HISTORY_KEYFRAME_INTERVAL);
+		else frame_history.initialize(tot_inner_rows, tot_inner_cols, true, (size_t)cfg->history_memory << 20, HISTORY_KEYFRAME_INTERVAL);
+		history_frame.cells = new uint8_t[frame_size];
+
+		start_render_thread();
+	}
+}
+
+void destroy_display() {
+	al_uninstall_keyboard();
+	al_uninstall_mouse();
+	al_destroy_bitmap(grid_bitmap);
+	delete[] displayed_grid;
+	if(threads_grid_bitmap)
+		al_destroy_bitmap(threads_grid_bitmap);
+	al_destroy_event_queue(queue);
+	al_destroy_display(display);
+	al_destroy_font(font);
+}
+
+// display of DISPLAY_WIDTH x DISPLAY_HEIGHT and the bitmap the grid is drawn in, starting all walls
+void create_display() {
+	wall_color = al_map_rgb(cfg->wall_color.r, cfg->wall_color.g, cfg->wall_color.b);
+	floor_color = al_map_rgb(cfg->floor_color.r, cfg->floor_color.g, cfg->floor_color.b);
+	threads_grid_color = al_map_rgb(cfg->threads_grid_color.r, cfg->threads_grid_color.g, cfg->threads_grid_color.b);
+
+	wall_pixel = to_pixel(cfg->wall_color);
+	floor_pixel = to_pixel(cfg->floor_color);
+	for(int density = 0; density < 256; density++) {
+		// blend from floor (0) to wall (255)
+		lod_pixels[density] = to_pixel({
+			cfg->floor_color.r + (cfg->wall_color.r - cfg->floor_color.r) * density / 255,
+			cfg->floor_color.g + (cfg->wall_color.g - cfg->floor_color.g) * density / 255,
+			cfg->floor_color.b + (cfg->wall_color.b - cfg->floor_color.b) * density / 255 });
+	}
+
+	if(!al_init()) fprintf(stderr, "Failed to initialize allegro.\n");
+	if(!al_install_keyboard()) fprintf(stderr, "Failed to install keyboard.\n");
+	if(!al_install_mouse()) fprintf(stderr, "Failed to install mouse.\n");
+	if(!al_init_font_addon()) fprintf(stderr, "Failed to initialize font addon.\n");
+	if(!al_init_ttf_addon()) fprintf(stderr, "Failed to initialize ttf addon.\n");
+	if(!al_init_primitives_addon()) fprintf(stderr, "Failed to initialize primitives addon.\n");
+
+	font = al_load_ttf_font("fonts/Roboto/Roboto-Medium.ttf", 20, 0);
+	display = al_create_display(DISPLAY_WIDTH, DISPLAY_HEIGHT);
+	queue = al_create_event_queue();
+	timer = al_create_timer(1.0 / cfg->max_frame_rate);
+
+	if(!font) fprintf(stderr, "Failed load font.\n");
+	if(!display) fprintf(stderr, "Failed initialize display.\n");
+	if(!queue) fprintf(stderr, "Failed create queue.\n");
+	if(!timer) fprintf(stderr, "Failed to create timer.\n");
+
+	al_register_event_source(queue, al_get_display_event_source(display));
+	al_register_event_source(queue, al_get_keyboard_event_source());
+	al_register_event_source(queue, al_get_mouse_event_source());
+	al_register_event_source(queue, al_get_timer_event_source(timer));
+	al_start_timer(timer);
+	al_start_timer(timer);
+
+	al_set_app_name("cave generator");
+
+	grid_bitmap_width = DISPLAY_WIDTH / cfg->cell_width;
+	grid_bitmap_height = DISPLAY_HEIGHT / cfg->cell_height;
+	grid_bitmap = al_create_bitmap(grid_bitmap_width, grid_bitmap_height);
+	if(!grid_bitmap) fprintf(stderr, "Failed to create grid bitmap.\n");
+
+	// edges are never redrawn
+	al_set_target_bitmap(grid_bitmap);
+	al_clear_to_color(wall_color);
+	displayed_grid = new uint8_t[grid_bitmap_width * grid_bitmap_height];
+	std::fill_n(displayed_grid, grid_bitmap_width * grid_bitmap_height, max_lod_block > 1 ? 255 : 1);
+	al_set_target_backbuffer(display);
+}
+
+
+/*
+ * ==================================================================================
+ *  --------------------------------------------------------------------------------
+ *  							  LEVEL OF DETAIL
+ *  --------------------------------------------------------------------------------
+ * ==================================================================================
+ */
+
+// range of view blocks touched by the cells [first, first + count)
+// view_first and view_size describe the view along the same axis
+void get_block_span(int first, int count, int view_first, int view_size, int& first_block, int& n_blocks) {
+	int start = std::max(first, view_first);
+	int end = std::min(first + count, view_first + view_size * lod_block);
+	if(start >= end) {
+		first_block = n_blocks = 0;
+		return;
+	}
+	first_block = (start - view_first) / lod_block;
+	n_blocks = (end - 1 - view_first) / lod_block - first_block + 1;
+}
+
+void get_proc_block_spans(int proc, int& first_block_row, int& block_rows, int& first_block_col, int& block_cols) {
+	get_block_span((proc / cfg->x_threads) * my_inner_rows, my_inner_rows, view_first_row, view_rows, first_block_row, block_rows);
+	get_block_span((proc % cfg->x_threads) * my_inner_cols, my_inner_cols, view_first_col, view_cols, first_block_col, block_cols);
+}
+
+void lod_initialize() {
+	// every process picks the same block size, only root draws
+	lod_block = cfg->lod;
+	if(lod_block <= 0) {
+		lod_block = 1;
+		while((long long)ceil_div(cfg->cols, lod_block) * ceil_div(cfg->rows, lod_block) > MAX_GRAPHIC_CELLS)
+			lod_block++;
+	}
+	max_lod_block = lod_block;
+	view_cols = ceil_div(cfg->cols, lod_block);
+	view_rows = ceil_div(cfg->rows, lod_block);
+
+	if(lod_block == 1)
+		return;
+
+	// a tile never touches more blocks than there are in view
+	lod_tile = new uint16_t[view_rows * view_cols];
+
+	if(is_display_process) {
+		// the display process may have no tile, it's the last one in display_comm
+		lod_counts = new int[n_procs + 1];
+		lod_displs = new int[n_procs + 1];
+
+		lod_root_tiles_size = cfg->is_parallel ? view_rows * view_cols : 0;
+		lod_root_tiles = cfg->is_parallel ? new uint16_t[lod_root_tiles_size] : lod_tile;
+		lod_walls = new uint32_t[view_rows * view_cols];
+	}
+}
+
+void lod_count_walls() {
+	if(!is_computing_process) {
+		my_block_rows = my_block_cols = 0;
+		return;
+	}
+	get_proc_block_spans(my_rank, my_first_block_row, my_block_rows, my_first_block_col, my_block_cols);
+	if(my_block_rows == 0 || my_block_cols == 0) {
+		// my tile is out of view, nothing to send
+		my_block_rows = my_block_cols = 0;
+		return;
+	}
+	std::fill_n(lod_tile, my_block_rows * my_block_cols, 0);
+
+	// only the cells of my tile in view are counted
+	int first_row = std::max(my_first_row, view_first_row);
+	int last_row = std::min(my_first_row + my_inner_rows, view_first_row + view_rows * lod_block);
+	int first_col = std::max(my_first_col, view_first_col);
+	int last_col = std::min(my_first_col + my_inner_cols, view_first_col + view_cols * lod_block);
+
+	for(int row = first_row; row < last_row; row++) {
+		int block_row = (row - view_first_row) / lod_block - my_first_block_row;
+		uint16_t* counts = &lod_tile[block_row * my_block_cols];
+		const uint8_t* cells = &read_grid[at(row - my_first_row + radius, first_col - my_first_col + radius)];
+
+		// sum each run of cells falling in the same block at once
+		int col = first_col;
+		while(col < last_col) {
+			int block_col = (col - view_first_col) / lod_block;
+			int block_end = std::min(view_first_col + (block_col + 1) * lod_block, last_col);
+			int walls = 0;
+			for(; col < block_end; col++)
+				walls += cells[col - first_col];
+			counts[block_col - my_first_block_col] += walls;
+		}
+	}
+}
+
+void gather_lod_grid() {
+	if(is_display_process) {
+		int total = 0;
+		for(int proc = 0; proc < n_procs; proc++) {
+			int first_block_row, block_rows, first_block_col, block_cols;
+			get_proc_block_spans(proc, first_block_row, block_rows, first_block_col, block_cols);
+			lod_counts[proc] = block_rows * block_cols;
+			lod_displs[proc] = total;
+			total += lod_counts[proc];
+		}
+		lod_counts[n_procs] = 0;
+		lod_displs[n_procs] = total;
+
+		// blocks split between tiles are sent more than once
+		if(total > lod_root_tiles_size) {
+			delete[] lod_root_tiles;
+			lod_root_tiles_size = total;
+			lod_root_tiles = new uint16_t[lod_root_tiles_size];
+		}
+	}
+
+	MPI_Gatherv(lod_tile, my_block_rows * my_block_cols, MPI_UINT16_T,
+		lod_root_tiles, lod_counts, lod_displs, MPI_UINT16_T, display_rank, display_comm);
+}
 
-		font = al_load_ttf_font("fonts/Roboto/Roboto-Medium.ttf", 20, 0);
-		display = al_create_display(DISPLAY_WIDTH, DISPLAY_HEIGHT);
-		queue = al_create_event_queue();
-		timer = al_create_timer(1.0 / cfg->max_frame_rate);
+/**
+ * displayed value of a block with walls walls among its cells cells inside the grid, cells past the grid don't count.
+ * blocks entirely past the grid are shown as walls.
+ * majority: 255 if at least half of the cells are walls, 0 otherwise, density: 0 to 255
+ */
+inline uint8_t lod_block_value(int walls, int cells, bool majority) {
+	if(cells == 0)
+		return 255;
+	if(majority)
+		return walls * 2 >= cells ? 255 : 0;
+	return walls * 255 / cells;
+}
 
-		if(!font) fprintf(stderr, "Failed load font.\n");
-		if(!display) fprintf(stderr, "Failed initialize display.\n");
-		if(!queue) fprintf(stderr, "Failed create queue.\n");
-		if(!timer) fprintf(stderr, "Failed to create timer.\n");
+void lod_build_view(uint8_t* view_cells) {
+	std::fill_n(lod_walls, view_rows * view_cols, 0);
 
-		al_register_event_source(queue, al_get_display_event_source(display));
-		al_register_event_source(queue, al_get_keyboard_event_source());
-		al_register_event_source(queue, al_get_timer_event_source(timer));
-		al_start_timer(timer);
-		al_start_timer(timer);
+	// blocks on the edge between two tiles are counted by both processes
+	int block_offset = 0;
+	for(int proc = 0; proc < n_procs; proc++) {
+		int first_block_row, block_rows, first_block_col, block_cols;
+		get_proc_block_spans(proc, first_block_row, block_rows, first_block_col, block_cols);
+
+		const uint16_t* counts = &lod_root_tiles[block_offset];
+		for(int i = 0; i < block_rows; i++) {
+			uint32_t* walls = &lod_walls[(first_block_row + i) * view_cols + first_block_col];
+			for(int j = 0; j < block_cols; j++)
+				walls[j] += counts[i * block_cols + j];
+		}
+		block_offset += block_rows * block_cols;
+	}
 
-		al_set_app_name("cave generator");
+	bool majority = cfg->lod_mode == "majority";
+	for(int i = 0; i < view_rows; i++) {
+		// blocks on the grid border may be cut, those past it are shown as walls
+		int first_row = view_first_row + i * lod_block;
+		int cells_rows = std::max(0, std::min(lod_block, cfg->rows - first_row));
+		for(int j = 0; j < view_cols; j++) {
+			int first_col = view_first_col + j * lod_block;
+			int cells = cells_rows * std::max(0, std::min(lod_block, cfg->cols - first_col));
+			view_cells[i * view_cols + j] = lod_block_value(lod_walls[i * view_cols + j], cells, majority);
+		}
 	}
 }
 
+// keeps the view inside the grid and hands it to the main thread
+void clamp_view() {
+	ui_view.first_row = std::max(0, std::min(ui_view.first_row, cfg->rows - view_rows * ui_view.lod_block));
+	ui_view.first_col = std::max(0, std::min(ui_view.first_col, cfg->cols - view_cols * ui_view.lod_block));
+
+	std::lock_guard<std::mutex> lock(view_mutex);
+	requested_view = ui_view;
+}
+
+// zooms keeping the cell under the pixel (x, y) in place
+void zoom_view(int new_lod_block, int x, int y) {
+	new_lod_block = std::max(1, std::min(new_lod_block, max_lod_block));
+	int row = ui_view.first_row + y * ui_view.lod_block / cfg->cell_height;
+	int col = ui_view.first_col + x * ui_view.lod_block / cfg->cell_width;
+	ui_view.first_row = row - y * new_lod_block / cfg->cell_height;
+	ui_view.first_col = col - x * new_lod_block / cfg->cell_width;
+	ui_view.lod_block = new_lod_block;
+	clamp_view();
+}
+
+// moves the view by a fraction of its size
+void pan_view(int rows_eighths, int cols_eighths) {
+	ui_view.first_row += rows_eighths * std::max(1, view_rows * ui_view.lod_block / 8);
+	ui_view.first_col += cols_eighths * std::max(1, view_cols * ui_view.lod_block / 8);
+	clamp_view();
+}
+
+/**
+ * ROOT ONLY, RENDER THREAD ONLY
+ * arrows/WASD: pan, +/-: zoom, 0/home: show the whole grid
+ * mouse wheel: zoom on the cursor, drag: pan
+ * returns false for the events that don't move the view
+ */
+bool handle_view_event(const ALLEGRO_EVENT& event) {
+	if(max_lod_block == 1)
+		return false;
+
+	if(event.type == ALLEGRO_EVENT_KEY_DOWN || event.type == ALLEGRO_EVENT_KEY_CHAR) {
+		// key char repeats while the key is held
+		if(event.type == ALLEGRO_EVENT_KEY_DOWN)
+			return true;
+		switch(event.keyboard.keycode) {
+		case ALLEGRO_KEY_UP: case ALLEGRO_KEY_W: pan_view(-1, 0); return true;
+		case ALLEGRO_KEY_DOWN: case ALLEGRO_KEY_S: pan_view(1, 0); return true;
+		case ALLEGRO_KEY_LEFT: case ALLEGRO_KEY_A: pan_view(0, -1); return true;
+		case ALLEGRO_KEY_RIGHT: case ALLEGRO_KEY_D: pan_view(0, 1); return true;
+		case ALLEGRO_KEY_EQUALS: case ALLEGRO_KEY_PAD_PLUS:
+			zoom_view(ui_view.lod_block / 2, DISPLAY_WIDTH / 2, DISPLAY_HEIGHT / 2); return true;
+		case ALLEGRO_KEY_MINUS: case ALLEGRO_KEY_PAD_MINUS:
+			zoom_view(ui_view.lod_block * 2, DISPLAY_WIDTH / 2, DISPLAY_HEIGHT / 2); return true;
+		case ALLEGRO_KEY_0: case ALLEGRO_KEY_HOME:
+			zoom_view(max_lod_block, 0, 0); return true;
+		default: return false;
+		}
+	}
+	if(event.type == ALLEGRO_EVENT_KEY_UP) {
+		switch(event.keyboard.keycode) {
+		case ALLEGRO_KEY_UP: case ALLEGRO_KEY_W: case ALLEGRO_KEY_DOWN: case ALLEGRO_KEY_S:
+		case ALLEGRO_KEY_LEFT: case ALLEGRO_KEY_A: case ALLEGRO_KEY_RIGHT: case ALLEGRO_KEY_D:
+		case ALLEGRO_KEY_EQUALS: case ALLEGRO_KEY_PAD_PLUS: case ALLEGRO_KEY_MINUS: case ALLEGRO_KEY_PAD_MINUS:
+		case ALLEGRO_KEY_0: case ALLEGRO_KEY_HOME:
+			return true;
+		default: return false;
+		}
+	}
+	if(event.type == ALLEGRO_EVENT_MOUSE_BUTTON_DOWN) {
+		is_dragging_view = true;
+		drag_start_x = event.mouse.x;
+		drag_start_y = event.mouse.y;
+		drag_start_row = ui_view.first_row;
+		drag_start_col = ui_view.first_col;
+		return true;
+	}
+	if(event.type == ALLEGRO_EVENT_MOUSE_BUTTON_UP) {
+		is_dragging_view = false;
+		return true;
+	}
+	if(event.type == ALLEGRO_EVENT_MOUSE_AXES) {
+		if(event.mouse.dz > 0)
+			zoom_view(ui_view.lod_block / 2, event.mouse.x, event.mouse.y);
+		else if(event.mouse.dz < 0)
+			zoom_view(ui_view.lod_block * 2, event.mouse.x, event.mouse.y);
+		else if(is_dragging_view) {
+			ui_view.first_row = drag_start_row - (event.mouse.y - drag_start_y) * ui_view.lod_block / cfg->cell_height;
+			ui_view.first_col = drag_start_col - (event.mouse.x - drag_start_x) * ui_view.lod_block / cfg->cell_width;
+			clamp_view();
+		}
+		return true;
+	}
+	return false;
+}
 
 
 /*
@@ -307,16 +999,73 @@ void parallel_initialize() {
 	MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
 	MPI_Comm_size(MPI_COMM_WORLD, &n_procs);
 
+	if(cfg->render_rank) {
+		// the last process only shows the grid, it's kept out of the cartesian grid
+		n_procs--;
+		is_computing_process = my_rank < n_procs;
+		is_display_process = !is_computing_process;
+		display_rank = n_procs;
+		MPI_Comm_split(MPI_COMM_WORLD, is_computing_process ? 0 : MPI_UNDEFINED, my_rank, &compute_comm);
+	}
+	else {
+		is_display_process = my_rank == ROOT_RANK;
+		compute_comm = MPI_COMM_WORLD;
+	}
+
 	check_parallel_settings();
 
-	int dims[2] = { cfg->y_threads, cfg->x_threads };
-	int periods[2] = { 0, 0 };
+	const int outer_sizes[] = { my_rows, my_cols };
+	const int inner_sizes[] = { my_inner_rows, my_inner_cols };
+	const int starts[] = { 0, 0 };
+	MPI_Type_create_subarray(2, outer_sizes, inner_sizes, starts, MPI_ORDER_C, MPI_UINT8_T, &inner_grid_t);
+
+	const int global_sizes[] = { tot_inner_rows, tot_inner_cols };
+	MPI_Datatype global_subarray_t;
+	MPI_Type_create_subarray(2, global_sizes, inner_sizes, starts, MPI_ORDER_C, MPI_UINT8_T, &global_subarray_t);
+	MPI_Type_create_resized(global_subarray_t, 0, my_inner_cols, &global_tile_t);
+	MPI_Type_free(&global_subarray_t);
+
+	MPI_Type_commit(&inner_grid_t);
+	MPI_Type_commit(&global_tile_t);
+
+	if(my_rank == ROOT_RANK || is_display_process) {
+		// the display process may have no tile, it's the last one in display_comm
+		tile_counts = new int[n_procs + 1];
+		tile_displs = new int[n_procs + 1];
+		for(int proc = 0; proc < n_procs; proc++) {
+			tile_counts[proc] = 1;
+			tile_displs[proc] = (proc / cfg->x_threads) * my_inner_rows * cfg->x_threads + (proc % cfg->x_threads);
+		}
+		tile_counts[n_procs] = 0;
+		tile_displs[n_procs] = 0;
+	}
+
+	if(!is_computing_process) {
+		cave_comm = MPI_COMM_NULL;
+		display_comm = MPI_COMM_WORLD;
+		return;
+	}
 
+	create_cave_topology(compute_comm);
+	display_comm = cfg->render_rank ? MPI_COMM_WORLD : cave_comm;
+}
 
-	MPI_Cart_create(MPI_COMM_WORLD, 2, dims, periods, 0, &cave_comm);
+/**
+ * COLLECTIVE over comm
+ * cave_comm as a y_threads x x_threads grid of comm, my neighbours and the halo types of my tile.
+ * my_inner_rows, my_inner_cols, my_cols and radius must be set
+ */
+void create_cave_topology(MPI_Comm comm) {
+	int dims[2] = { cfg->y_threads, cfg->x_threads };
+	int periods[2] = { 0, 0 };
+	MPI_Cart_create(comm, 2, dims, periods, 0, &cave_comm);
 
+	int cave_rank;
+	MPI_Comm_rank(cave_comm, &cave_rank);
 	int my_coords[2];
-	MPI_Cart_coords(cave_comm, my_rank, 2, my_coords);
+	MPI_Cart_coords(cave_comm, cave_rank, 2, my_coords);
+	my_first_row = my_coords[0] * my_inner_rows;
+	my_first_col = my_coords[1] * my_inner_cols;
 
 	for(int i = 0; i < 3; i++) {
 		for(int j = 0; j < 3; j++) {
@@ -331,26 +1080,25 @@ void parallel_initialize() {
 		}
 	}
 
-	const int outer_sizes[] = { my_rows, my_cols };
-	const int inner_sizes[] = { my_inner_rows, my_inner_cols };
-	const int starts[] = { 0, 0 };
-	MPI_Type_create_subarray(2, outer_sizes, inner_sizes, starts, MPI_ORDER_C, MPI_UINT8_T, &inner_grid_t);
-	MPI_Type_contiguous(inner_grid_size, MPI_UINT8_T, &contiguous_grid_t);
-
 	MPI_Type_vector(my_inner_rows, radius, my_cols, MPI_UINT8_T, &column_t);
 	MPI_Type_vector(radius, my_inner_cols, my_cols, MPI_UINT8_T, &row_t);
 	MPI_Type_vector(radius, radius, my_cols, MPI_UINT8_T, &corner_t);
 
 
 
-	MPI_Type_commit(&inner_grid_t);
-	MPI_Type_commit(&contiguous_grid_t);
 	MPI_Type_commit(&column_t);
 	MPI_Type_commit(&row_t);
 	MPI_Type_commit(&corner_t);
 
 }
 
+void free_cave_topology() {
+	MPI_Type_free(&column_t);
+	MPI_Type_free(&row_t);
+	MPI_Type_free(&corner_t);
+	MPI_Comm_free(&cave_comm);
+}
+
 
 void serial_initialize_random_grid() {
 	if(cfg->rand_seed)
@@ -376,28 +1124,42 @@ void serial_initialize_random_grid() {
 
 void terminate()
 {
-	if(my_rank == ROOT_RANK && cfg->show_graphics) {
-		al_uninstall_keyboard();
-		al_destroy_event_queue(queue);
-		al_destroy_display(display);
-		al_destroy_font(font);
+	if(is_display_process && cfg->show_graphics) {
+		for(int i = 0; i < FRAME_POOL_SIZE; i++)
+			delete[] frame_pool[i].cells;
+		delete[] history_frame.cells;
+		destroy_display();
 	}
 
-	// delete[] frame_times;
+
+	if(cfg->show_graphics && max_lod_block > 1) {
+		if(is_display_process) {
+			if(lod_root_tiles != lod_tile)
+				delete[] lod_root_tiles;
+			delete[] lod_walls;
+			delete[] lod_counts;
+			delete[] lod_displs;
+		}
+		delete[] lod_tile;
+	}
 
 	if(cfg->is_parallel) {
 		if(my_rank == ROOT_RANK) {
 			delete[] root_grid;
 		}
+		if(my_rank == ROOT_RANK || is_display_process) {
+			delete[] tile_counts;
+			delete[] tile_displs;
+		}
 
 		MPI_Type_free(&inner_grid_t);
-		MPI_Type_free(&contiguous_grid_t);
-		MPI_Type_free(&column_t);
-		MPI_Type_free(&row_t);
-		MPI_Type_free(&corner_t);
-
-		MPI_Comm_free(&cave_comm);
+		MPI_Type_free(&global_tile_t);
 
+		if(is_computing_process) {
+			free_cave_topology();
+			if(cfg->render_rank)
+				MPI_Comm_free(&compute_comm);
+		}
 	}
 	MPI_Finalize();
 
@@ -429,9 +1191,16 @@ void check_parallel_settings() {
 		std::cout << "cols: " << cfg->cols << " x_threads: " << cfg->x_threads << std::endl;
 		exit();
 	}
+	// the display process only renders, recordings and saves are written by the computing processes
+	if(cfg->render_rank && !cfg->show_graphics) {
+		std::cout << "render_rank needs graphic mode" << std::endl;
+		exit();
+	}
 	if(cfg->y_threads * cfg->x_threads != n_procs) {
 			// make sure the product of dims is equal to the number of processes
 		std::cout << "Error: number of processes does not match the number of threads" << std::endl;
+		if(cfg->render_rank)
+			std::cout << "with render_rank there must be one more process than threads" << std::endl;
 		std::cout << "number of processes: " << n_procs << std::endl;
 		std::cout << "number of threads per row: " << cfg->y_threads << std::endl;
 		std::cout << "number of threads per column: " << cfg->x_threads << std::endl;
@@ -440,10 +1209,22 @@ void check_parallel_settings() {
 }
 
 void check_graphic_settings() {
-	if(cfg->cols * cfg->rows > 1382400) {
+	if((long long)view_cols * view_rows > MAX_GRAPHIC_CELLS) {
 		std::cout << "Grid is too large for graphic mode" << std::endl;
+		std::cout << "use a larger lod, or 0 to pick one automatically" << std::endl;
+		exit();
+	}
+	if(lod_block > 255) {
+		// walls in a block are counted in 16 bits
+		std::cout << "lod can't be larger than 255" << std::endl;
 		exit();
 	}
+	if(cfg->lod_mode != "majority" && cfg->lod_mode != "density") {
+		std::cout << "lod_mode must be either \"majority\" or \"density\"" << std::endl;
+		exit();
+	}
+	if(lod_block > 1)
+		std::cout << "Showing 1 cell every " << lod_block << "x" << lod_block << " block" << std::endl;
 }
 
 
@@ -458,144 +1239,256 @@ void check_graphic_settings() {
 
 void graphic_parallel_loop() {
 	while(is_running) {
-		if(my_rank == ROOT_RANK) {
-			ALLEGRO_EVENT event;
-			al_wait_for_event(queue, &event);
-			if(event.type == ALLEGRO_EVENT_KEY_UP || event.type == ALLEGRO_EVENT_DISPLAY_CLOSE) {
-				std::cout << "Abortings..." << std::endl;
-				exit();
-			}
-			else if(event.type == ALLEGRO_EVENT_TIMER) {
-				frame_update();
-				if(++generation == cfg->last_generation) {
-					is_running = false;
-				}
-			}
-		}
-		else {
-			frame_update();
-			if(++generation == cfg->last_generation) {
-				is_running = false;
-			}
-		}
+		frame_update();
+	}
+
+	if(is_display_process)
+		stop_render_thread();
+
+	if(cfg->render_rank) {
+		// root reports the draw time of the display process
+		double display_draw_time = 0;
+		MPI_Reduce(&draw_time, &display_draw_time, 1, MPI_DOUBLE, MPI_MAX, ROOT_RANK, MPI_COMM_WORLD);
+		if(my_rank == ROOT_RANK)
+			draw_time = display_draw_time;
 	}
 }
 
 void graphic_serial_loop() {
 	while(is_running) {
-		ALLEGRO_EVENT event;
-		al_wait_for_event(queue, &event);
-		if(event.type == ALLEGRO_EVENT_KEY_UP || event.type == ALLEGRO_EVENT_DISPLAY_CLOSE) {
-			std::cout << "Abortings..." << std::endl;
-			exit();
-		}
-		else if(event.type == ALLEGRO_EVENT_TIMER) {
-			frame_update();
-			if(++generation == cfg->last_generation) {
-				is_running = false;
-			}
-		}
+		frame_update();
 	}
+	stop_render_thread();
 }
 
 
 void no_graphic_loop() {
 	while(is_running) {
-		frame_update();
-		if(++generation == cfg->last_generation) {
-			is_running = false;
-		}
+		generation_update();
 	}
 }
 
-void frame_update() {
-	// double frame_start_time = MPI_Wtime();
-	if(cfg->show_graphics) {
-		if(my_rank == ROOT_RANK) {
-			double start_draw_time = MPI_Wtime();
-			al_flip_display();
-			al_clear_to_color(wall_color);
+// the display process decides what happens in the next frame, everyone else follows
+void broadcast_frame_command(bool& has_frame) {
+	int command[5] = { generations_per_frame, has_frame, view_first_row, view_first_col, lod_block };
+	MPI_Bcast(command, 5, MPI_INT, display_rank, display_comm);
+	generations_per_frame = command[0];
+	has_frame = command[1];
+	view_first_row = command[2];
+	view_first_col = command[3];
+	lod_block = command[4];
+}
 
-			if(cfg->is_parallel) {
-				//receive the grid from the other processes
-				double receive_start_time = MPI_Wtime();
-				gather_grid();
-				communication_time += MPI_Wtime() - receive_start_time;
+/**
+ * DISPLAY PROCESS ONLY
+ * fits as many generations as possible in the time between two frames,
+ * unless generations_per_frame is fixed in the config
+ */
+void adapt_generations_per_frame(double frame_draw_time, double frame_generations_time, int frame_generations) {
+	if(cfg->generations_per_frame > 0) {
+		generations_per_frame = cfg->generations_per_frame;
+		return;
+	}
+	if(frame_generations == 0)
+		return;
 
-				parallel_draw_grid();
-			}
-			else {
-				serial_draw_grid();
-			}
+	double last_seconds_per_generation = frame_generations_time / frame_generations;
+	if(seconds_per_generation == 0)
+		seconds_per_generation = last_seconds_per_generation;
+	else seconds_per_generation = 0.8 * seconds_per_generation + 0.2 * last_seconds_per_generation;
+
+	double budget = (1.0 / cfg->max_frame_rate - frame_draw_time) * FRAME_BUDGET_USAGE;
+	double fitting_generations = budget / std::max(seconds_per_generation, 1e-9);
+	generations_per_frame = (int)std::max(1.0, std::min(fitting_generations, (double)MAX_GENERATIONS_PER_FRAME));
+}
+
+/**
+ * DISPLAY PROCESS ONLY
+ * a free frame if the render thread wants one, nullptr otherwise.
+ * with a fixed number of generations per frame it waits for the render thread,
+ * so the display paces the simulation.
+ * while paused it waits for the user, is_step is set when a single generation has to run
+ */
+Frame* take_frame(bool& is_step) {
+	std::unique_lock<std::mutex> lock(frame_wanted_mutex);
+	frame_wanted_cv.wait(lock, [] { return !is_paused || pending_steps > 0 || quit_requested; });
+	is_step = is_paused && pending_steps > 0;
+	if(is_step)
+		pending_steps--;
+
+	if(cfg->generations_per_frame > 0 || is_step)
+		frame_wanted_cv.wait(lock, [] { return is_frame_wanted || quit_requested; });
+
+	Frame* frame = nullptr;
+	if(is_frame_wanted && free_frames.pop(frame))
+		is_frame_wanted = false;
+	return frame;
+}
 
-			double end_draw_time = MPI_Wtime();
-			draw_time += end_draw_time - start_draw_time;
+// GRAPHIC ONLY
+// gathers the current generation if a frame is wanted, then runs the generations until the next one
+void frame_update() {
+	Frame* frame = nullptr;
+	if(is_display_process) {
+		if(quit_requested) {
+			std::cout << "Abortings..." << std::endl;
+			exit();
 		}
-		else { // my_rank != ROOT_RANK
 
-			// send read_grid to root
+		bool is_step;
+		frame = take_frame(is_step);
+		// a step shows the current generation and runs one more
+		if(is_step)
+			generations_per_frame = 1;
+		std::lock_guard<std::mutex> lock(view_mutex);
+		view_first_row = requested_view.first_row;
+		view_first_col = requested_view.first_col;
+		lod_block = requested_view.lod_block;
+	}
+
+	bool has_frame = frame != nullptr;
+	if(cfg->is_parallel)
+		broadcast_frame_command(has_frame);
+
+	double frame_start_time = MPI_Wtime();
+	if(has_frame)
+		draw_frame(frame);
+
+	double generations_start_time = MPI_Wtime();
+	int frame_generations = 0;
+	while(is_running && frame_generations < generations_per_frame) {
+		if(is_computing_process)
+			generation_update();
+		else count_generation();
+		frame_generations++;
+	}
+	double generations_time = MPI_Wtime() - generations_start_time;
+
+	if(cfg->render_rank) {
+		// the display process doesn't compute, root tells it how long the generations took
+		if(my_rank == ROOT_RANK)
+			MPI_Send(&generations_time, 1, MPI_DOUBLE, display_rank, GENERATIONS_TIME_TAG, MPI_COMM_WORLD);
+		else if(is_display_process)
+			MPI_Recv(&generations_time, 1, MPI_DOUBLE, ROOT_RANK, GENERATIONS_TIME_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+	}
+
+	if(is_display_process)
+		adapt_generations_per_frame(generations_start_time - frame_start_time, generations_time, frame_generations);
+}
+
+// collects the current generation in the frame, root hands it to the render thread
+void draw_frame(Frame* frame) {
+	perf_draw.begin(perf_counters);
+	double start_draw_time = MPI_Wtime();
+
+	if(max_lod_block > 1) {
+		lod_count_walls();
+
+		if(cfg->is_parallel) {
 			double receive_start_time = MPI_Wtime();
-			gather_grid();
+			gather_lod_grid();
+			trace(TRACE_GATHER, receive_start_time);
 			communication_time += MPI_Wtime() - receive_start_time;
 		}
+
+		if(is_display_process)
+			lod_build_view(frame->cells);
+	}
+	else gather_whole_grid(is_display_process ? frame->cells : nullptr);
+
+	if(is_display_process) {
+		frame->view = { view_first_row, view_first_col, lod_block };
+		frame->generation = generation;
+		ready_frames.push(frame);
 	}
+	trace(TRACE_DRAW, start_draw_time);
+	draw_time += MPI_Wtime() - start_draw_time;
+	perf_draw.end(perf_counters);
+}
 
+void generation_update() {
+	double start_generation_time = MPI_Wtime();
 	if(cfg->is_parallel) {
 		// send columns to other processes
+		perf_halo.begin(perf_counters);
 		double comms_start_time = MPI_Wtime();
+		double phase_start_time = comms_start_time;
 		send_columns();
+		phase_start_time = trace(TRACE_SEND_COLUMNS, phase_start_time);
 
 		// send rows to other processes
 		send_rows();
+		phase_start_time = trace(TRACE_SEND_ROWS, phase_start_time);
 
 		// send corners to other processes
 		send_corners();
+		phase_start_time = trace(TRACE_SEND_CORNERS, phase_start_time);
 
 		// receive columns from other processes
 		receive_columns();
+		phase_start_time = trace(TRACE_RECEIVE_COLUMNS, phase_start_time);
 
 		// receive rows from other processes
 		receive_rows();
+		phase_start_time = trace(TRACE_RECEIVE_ROWS, phase_start_time);
 
 		// receive corners from other processes
 		receive_corners();
-		communication_time += MPI_Wtime() - comms_start_time;
+		trace(TRACE_RECEIVE_CORNERS, phase_start_time);
+		double halo_time = MPI_Wtime() - comms_start_time;
+		perf_halo.end(perf_counters);
+		communication_time += halo_time;
+		halo_latency.add(halo_time);
 	}
 
 
+	perf_update.begin(perf_counters);
 	double generation_start_time = MPI_Wtime();
 	update_grid();
-	generation_time += MPI_Wtime() - generation_start_time;
+	trace(TRACE_UPDATE, generation_start_time);
+	perf_update.end(perf_counters);
+	double update_time = MPI_Wtime() - generation_start_time;
+	generation_time += update_time;
+	update_latency.add(update_time);
 	std::swap(read_grid, write_grid);
 
-	// double frame_end_time = MPI_Wtime();
-	// frame_times[generation] = frame_end_time - frame_start_time;
+	count_generation();
+
+	if(cfg->checkpoint_interval > 0 && generation % cfg->checkpoint_interval == 0) {
+		double checkpoint_start_time = MPI_Wtime();
+		write_checkpoint();
+		trace(TRACE_CHECKPOINT, checkpoint_start_time);
+	}
+	if(!cfg->record_path.empty() && generation % cfg->record_interval == 0) {
+		double record_start_time = MPI_Wtime();
+		record_generation();
+		trace(TRACE_RECORD, record_start_time);
+	}
+	generation_latency.add(MPI_Wtime() - start_generation_time);
 }
 
-int get_neighbour_walls(int y, int x) {
-	int walls = 0;
-	for(int i = y - radius; i <= y + radius; i++)
-		for(int j = x - radius; j <= x + radius; j++) {
-			walls += read_grid[at(i, j)];
-		}
+// the whole row-major grid on the display process, dest_grid is ignored everywhere else
+void gather_whole_grid(uint8_t* dest_grid) {
+	if(cfg->is_parallel) {
+		double receive_start_time = MPI_Wtime();
+		gather_grid(dest_grid);
+		trace(TRACE_GATHER, receive_start_time);
+		communication_time += MPI_Wtime() - receive_start_time;
+	}
+	else {
+		for(int i = 0; i < my_inner_rows; i++)
+			std::copy_n(&read_grid[at(i + radius, radius)], my_inner_cols, &dest_grid[i * my_inner_cols]);
+	}
+}
 
-	walls -= read_grid[at(y, x)];
-	return walls;
+void count_generation() {
+	if(++generation == cfg->last_generation) {
+		is_running = false;
+	}
 }
 
 void update_grid() {
-	for(int i = radius; i < my_rows - radius; i++) {
-		for(int j = radius; j < my_cols - radius; j++) {
-			int walls = get_neighbour_walls(i, j);
-
-			if(walls >= half_neighbours + cfg->roughness)
-				write_grid[at(i, j)] = 1;
-			else if(walls <= half_neighbours - cfg->roughness)
-				write_grid[at(i, j)] = 0;
-			else
-				write_grid[at(i, j)] = read_grid[at(i, j)];
-		}
-	}
+	update_cells(read_grid, write_grid, my_rows, my_cols, radius, cfg->roughness);
 }
 
 
@@ -608,61 +1501,590 @@ void update_grid() {
  * ==================================================================================
  */
 
-void parallel_draw_grid() {
-	// offset in cells, not pixels
-	int edge_offset = edge_offset = cfg->draw_edges ? radius : 0;
+inline uint32_t* pixel_row(ALLEGRO_LOCKED_REGION* region, int y) {
+	// pitch is negative when rows are stored bottom up
+	return (uint32_t*)((uint8_t*)region->data + y * region->pitch);
+}
 
-	for(int proc = 0; proc < n_procs; proc++) {
+ALLEGRO_LOCKED_REGION* lock_grid_bitmap(int x, int y, int width, int height) {
+	return al_lock_bitmap_region(grid_bitmap, x, y, width, height, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_WRITEONLY);
+}
 
-		int proc_x = (proc % cfg->x_threads) * my_inner_cols + edge_offset;
-		int proc_y = (proc / cfg->x_threads) * my_inner_rows + edge_offset;
+// cells are 0 or 1, kept branchless so the loop gets vectorized
+void expand_cells(const uint8_t* cells, uint32_t* pixels, int n) {
+	const uint32_t diff = wall_pixel ^ floor_pixel;
+	for(int j = 0; j < n; j++)
+		pixels[j] = floor_pixel ^ (diff & -(uint32_t)cells[j]);
+}
 
-		int proc_x2 = ((proc % cfg->x_threads) + 1) * my_inner_cols + edge_offset;
-		int proc_y2 = ((proc / cfg->x_threads) + 1) * my_inner_rows + edge_offset;
+/**
+ * redraws in grid_bitmap only the bands of rows that changed since the last frame
+ * cells is a width x height rectangle, with rows stride apart, drawn at (x, y)
+ * densities are 0-255 in level of detail, otherwise cells are 0 or 1
+ * returns true if anything was redrawn
+ */
+bool update_grid_bitmap(const uint8_t* cells, int stride, int x, int y, int width, int height, bool is_density) {
+	bool changed = false;
+
+	for(int band = 0; band < height; band += DIRTY_BAND_ROWS) {
+		int band_rows = std::min(DIRTY_BAND_ROWS, height - band);
+
+		// smallest span of columns holding every change in the band
+		int first_dirty = width, last_dirty = -1;
+		for(int i = band; i < band + band_rows; i++) {
+			const uint8_t* row = &cells[i * stride];
+			const uint8_t* displayed = &displayed_grid[(y + i) * grid_bitmap_width + x];
+			if(std::memcmp(row, displayed, width) == 0)
+				continue;
+
+			int j = 0;
+			while(j < first_dirty && row[j] == displayed[j]) j++;
+			first_dirty = j;
+			j = width - 1;
+			while(j > last_dirty && row[j] == displayed[j]) j--;
+			last_dirty = j;
+		}
+		if(last_dirty < first_dirty)
+			continue;
+
+		int dirty_width = last_dirty - first_dirty + 1;
+		ALLEGRO_LOCKED_REGION* region = lock_grid_bitmap(x + first_dirty, y + band, dirty_width, band_rows);
+		for(int i = 0; i < band_rows; i++) {
+			const uint8_t* row = &cells[(band + i) * stride + first_dirty];
+			uint32_t* pixels = pixel_row(region, i);
+			if(is_density) {
+				for(int j = 0; j < dirty_width; j++)
+					pixels[j] = lod_pixels[row[j]];
+			}
+			else expand_cells(row, pixels, dirty_width);
+			std::copy_n(row, dirty_width, &displayed_grid[(y + band + i) * grid_bitmap_width + x + first_dirty]);
+		}
+		al_unlock_bitmap(grid_bitmap);
+		changed = true;
+	}
+	return changed;
+}
 
+bool lod_draw_grid(const uint8_t* view_cells) {
+	return update_grid_bitmap(view_cells, view_cols, 0, 0, view_cols, view_rows, true);
+}
 
-		for(int i = 0; i < my_inner_rows; i++) {
 
-			int y = (i + proc_y) * cfg->cell_height;
+// cells is the full row-major grid, both in serial and in parallel
+bool full_draw_grid(const uint8_t* cells) {
+	// edges are never written, they stay as walls
+	int edge_offset = cfg->draw_edges ? radius : 0;
+	return update_grid_bitmap(cells, tot_inner_cols,
+		edge_offset, edge_offset, tot_inner_cols, tot_inner_rows, false);
+}
 
-			for(int j = 0; j < my_inner_cols; j++) {
+// redraws the threads grid only when the view has moved
+bool update_threads_grid_bitmap(const View& view) {
+	if(threads_grid_view[0] == view.first_row && threads_grid_view[1] == view.first_col && threads_grid_view[2] == view.lod_block)
+		return false;
+	threads_grid_view[0] = view.first_row;
+	threads_grid_view[1] = view.first_col;
+	threads_grid_view[2] = view.lod_block;
 
-				int idx = (proc * inner_grid_size) + (i * my_inner_cols) + j;
-				if(root_grid[idx] == 0) {
+	// offset in cells, not pixels
+	int edge_offset = (cfg->draw_edges && max_lod_block == 1) ? radius : 0;
+	// tiles borders may fall inside a block
+	float block_width = (float)cfg->cell_width / view.lod_block;
+	float block_height = (float)cfg->cell_height / view.lod_block;
 
-					int x = (j + proc_x) * cfg->cell_width;
-					al_draw_filled_rectangle(x, y, x + cfg->cell_width, y + cfg->cell_height, floor_color);
+	al_set_target_bitmap(threads_grid_bitmap);
+	al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+	for(int proc = 0; proc < n_procs; proc++) {
+		int proc_x = (proc % cfg->x_threads) * my_inner_cols - view.first_col;
+		int proc_y = (proc / cfg->x_threads) * my_inner_rows - view.first_row;
+		al_draw_rectangle(
+			proc_x * block_width + edge_offset * cfg->cell_width,
+			proc_y * block_height + edge_offset * cfg->cell_height,
+			(proc_x + my_inner_cols) * block_width + edge_offset * cfg->cell_width,
+			(proc_y + my_inner_rows) * block_height + edge_offset * cfg->cell_height,
+			threads_grid_color, 1);
+	}
+	al_set_target_backbuffer(display);
+	return true;
+}
 
-				}
-			}
-		}
+// the whole grid is drawn with a single scaled blit, and only if something changed
+void present_grid(const Frame* frame, bool grid_changed) {
+	bool threads_grid_changed = threads_grid_bitmap && update_threads_grid_bitmap(frame->view);
+	if(!grid_changed && !threads_grid_changed && !force_redraw)
+		return; // the display is already showing this frame
+	redraw_display();
+}
 
-		if(cfg->draw_threads_grid) {
-			al_draw_rectangle(proc_x * cfg->cell_width, proc_y * cfg->cell_height, proc_x2 * cfg->cell_width, proc_y2 * cfg->cell_height, threads_grid_color, 1);
-		}
-	}
+// draws again what grid_bitmap and threads_grid_bitmap hold, the frame last presented
+void redraw_display() {
+	force_redraw = false;
+	al_draw_scaled_bitmap(grid_bitmap, 0, 0, grid_bitmap_width, grid_bitmap_height, 0, 0, DISPLAY_WIDTH, DISPLAY_HEIGHT, 0);
+	if(threads_grid_bitmap)
+		al_draw_bitmap(threads_grid_bitmap, 0, 0, 0);
+	al_flip_display();
 }
 
+// RENDER THREAD ONLY
+void render_frame(Frame* frame) {
+	bool grid_changed;
+	if(max_lod_block > 1)
+		grid_changed = lod_draw_grid(frame->cells);
+	else grid_changed = full_draw_grid(frame->cells);
 
-void serial_draw_grid() {
+	present_grid(frame, grid_changed);
+}
 
-	for(int i = radius; i < my_rows - radius; i++) {
-		for(int j = radius; j < my_cols - radius; j++) {
-			if(read_grid[at(i, j)] == 0) {
+// RENDER THREAD ONLY
+void update_history_title() {
+	std::string title = "cave generator";
+	if(is_paused)
+		title += " - paused at generation " + std::to_string(history_frame.generation);
+	if(history_frames_back > 0)
+		title += " (" + std::to_string(history_frames_back) + " frames back)";
+	al_set_window_title(display, title.c_str());
+}
 
-				int y = (i - (!cfg->draw_edges * radius)) * cfg->cell_height;
-				int x = (j - (!cfg->draw_edges * radius)) * cfg->cell_width;
+// RENDER THREAD ONLY
+// draws the frame history_frames_back frames before the newest one
+void show_history_frame() {
+	history_frames_back = std::max(0, std::min(history_frames_back, frame_history.size() - 1));
+	FrameInfo info;
+	if(!frame_history.get(frame_history.size() - 1 - history_frames_back, history_frame.cells, info))
+		return;
+	history_frame.view = info.view;
+	history_frame.generation = info.generation;
+	render_frame(&history_frame);
+	update_history_title();
+}
 
-				al_draw_filled_rectangle(x, y, x + cfg->cell_width, y + cfg->cell_height, floor_color);
+// RENDER THREAD ONLY
+void set_paused(bool paused) {
+	std::lock_guard<std::mutex> lock(frame_wanted_mutex);
+	is_paused = paused;
+	frame_wanted_cv.notify_one();
+}
 
-			}
+/**
+ * ROOT ONLY, RENDER THREAD ONLY
+ * p/space: pause and resume, comma/period: one frame back and forth, a step forward
+ * from the newest frame runs one generation, page up/down: HISTORY_PAGE_FRAMES frames back and forth,
+ * end: back to the newest frame
+ * returns false for the events that aren't about the history
+ */
+bool handle_history_event(const ALLEGRO_EVENT& event) {
+	if(event.type != ALLEGRO_EVENT_KEY_DOWN && event.type != ALLEGRO_EVENT_KEY_CHAR && event.type != ALLEGRO_EVENT_KEY_UP)
+		return false;
+
+	switch(event.keyboard.keycode) {
+	case ALLEGRO_KEY_P: case ALLEGRO_KEY_SPACE: case ALLEGRO_KEY_COMMA: case ALLEGRO_KEY_FULLSTOP:
+	case ALLEGRO_KEY_PGUP: case ALLEGRO_KEY_PGDN: case ALLEGRO_KEY_END:
+		break;
+	default: return false;
+	}
+	// key char repeats while the key is held
+	if(event.type != ALLEGRO_EVENT_KEY_CHAR)
+		return true;
+
+	switch(event.keyboard.keycode) {
+	case ALLEGRO_KEY_P: case ALLEGRO_KEY_SPACE:
+		// resuming goes back to the newest frame
+		set_paused(!is_paused);
+		history_frames_back = 0;
+		break;
+	case ALLEGRO_KEY_COMMA:
+		set_paused(true);
+		history_frames_back++;
+		break;
+	case ALLEGRO_KEY_PGUP:
+		set_paused(true);
+		history_frames_back += HISTORY_PAGE_FRAMES;
+		break;
+	case ALLEGRO_KEY_PGDN:
+		history_frames_back = std::max(0, history_frames_back - HISTORY_PAGE_FRAMES);
+		break;
+	case ALLEGRO_KEY_END:
+		history_frames_back = 0;
+		break;
+	case ALLEGRO_KEY_FULLSTOP:
+		if(history_frames_back > 0) {
+			history_frames_back--;
+			break;
+		}
+		{
+			// the newest frame is on display, the main thread runs one generation
+			std::lock_guard<std::mutex> lock(frame_wanted_mutex);
+			is_paused = true;
+			pending_steps++;
+			frame_wanted_cv.notify_one();
 		}
+		break;
 	}
+	show_history_frame();
+	return true;
 }
 
+// RENDER THREAD ONLY
+// handles the user input and draws the newest frame on every timer tick
+void render_loop() {
+	al_set_target_backbuffer(display);
 
-
-/*
+	while(is_rendering) {
+		ALLEGRO_EVENT event;
+		al_wait_for_event(queue, &event);
+		if(handle_view_event(event) || handle_history_event(event))
+			continue;
+		if(event.type == ALLEGRO_EVENT_KEY_UP || event.type == ALLEGRO_EVENT_DISPLAY_CLOSE) {
+			// the main thread aborts, it's the only one making MPI calls
+			std::lock_guard<std::mutex> lock(frame_wanted_mutex);
+			quit_requested = true;
+			frame_wanted_cv.notify_one();
+		}
+		else if(event.type == ALLEGRO_EVENT_DISPLAY_EXPOSE || event.type == ALLEGRO_EVENT_DISPLAY_SWITCH_IN
+			|| event.type == ALLEGRO_EVENT_DISPLAY_FOUND) {
+			// the window lost what was drawn on it, and a static grid brings no new frame to draw it again
+			force_redraw = true;
+			redraw_display();
+		}
+		else if(event.type == ALLEGRO_EVENT_TIMER) {
+			// frames that were never shown go back to the pool, but they're all kept in the history
+			auto start_render_time = std::chrono::steady_clock::now();
+			Frame* frame = nullptr;
+			Frame* newer_frame;
+			while(ready_frames.pop(newer_frame)) {
+				if(frame)
+					free_frames.push(frame);
+				frame = newer_frame;
+				frame_history.push(frame->cells, { frame->view, frame->generation });
+				// the frame looked at in the history stays on display
+				if(history_frames_back > 0)
+					history_frames_back++;
+			}
+
+			if(frame) {
+				if(history_frames_back == 0) {
+					render_frame(frame);
+					if(is_paused) {
+						history_frame.generation = frame->generation;
+						update_history_title();
+					}
+				}
+				free_frames.push(frame);
+			}
+			render_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - start_render_time).count();
+
+			std::lock_guard<std::mutex> lock(frame_wanted_mutex);
+			is_frame_wanted = true;
+			frame_wanted_cv.notify_one();
+		}
+	}
+
+	al_set_target_bitmap(NULL);
+}
+
+void start_render_thread() {
+	// the display can only be drawn on by one thread at a time
+	al_set_target_bitmap(NULL);
+	render_thread = std::thread(render_loop);
+}
+
+void stop_render_thread() {
+	is_rendering = false;
+	render_thread.join();
+	draw_time += render_time;
+}
+
+
+
+/*
+ * ==================================================================================
+ *  --------------------------------------------------------------------------------
+ *  								RECORDING
+ *  --------------------------------------------------------------------------------
+ * ==================================================================================
+ */
+
+void check_record_settings() {
+	if(cfg->record_format != "gif" && cfg->record_format != "cave" && cfg->record_format != "pgm" && cfg->record_format != "png") {
+		std::cout << "record_format must be \"gif\", \"cave\", \"pgm\" or \"png\"" << std::endl;
+		exit();
+	}
+	if(cfg->record_interval < 1 || cfg->record_keyframe_interval < 1) {
+		std::cout << "record_interval and record_keyframe_interval must be at least 1" << std::endl;
+		exit();
+	}
+	if(cfg->render_rank) {
+		// generations are gathered on root, which the display process doesn't follow
+		std::cout << "recording can't be used with render_rank" << std::endl;
+		exit();
+	}
+	if(cfg->record_format == "gif" && (tot_inner_rows > 65535 || tot_inner_cols > 65535)) {
+		std::cout << "gif frames can't be larger than 65535x65535" << std::endl;
+		exit();
+	}
+}
+
+// RECORD THREAD ONLY
+std::string record_frame_path(int frame_generation) {
+	std::string number = std::to_string(frame_generation);
+	number.insert(0, std::max(0, 8 - (int)number.size()), '0');
+	return cfg->record_path + "/generation_" + number + "." + cfg->record_format;
+}
+
+// RECORD THREAD ONLY
+bool write_record_frame(const RecordFrame& frame) {
+	if(cfg->record_format == "gif") {
+		gif_writer.add_frame(frame.cells);
+		return gif_writer.good();
+	}
+	if(cfg->record_format == "cave")
+		return cave_writer.add_frame(frame.cells, frame.generation);
+	if(cfg->record_format == "png")
+		return write_png(record_frame_path(frame.generation), frame.cells, tot_inner_cols, tot_inner_rows, tot_inner_cols, cfg->floor_color, cfg->wall_color);
+
+	std::ofstream file(record_frame_path(frame.generation), std::ios::binary);
+	std::string header = grid_header(GRID_PGM, tot_inner_rows, tot_inner_cols);
+	GridTile tile = { tot_inner_rows, tot_inner_cols, 0, 0, tot_inner_rows, tot_inner_cols };
+	uint8_t* pixels = new uint8_t[tot_inner_rows * tot_inner_cols];
+	grid_pack_tile(GRID_PGM, tile, frame.cells, tot_inner_cols, pixels, tot_inner_cols);
+	file.write(header.data(), header.size());
+	file.write((const char*)pixels, tot_inner_rows * tot_inner_cols);
+	delete[] pixels;
+	return file.good();
+}
+
+// RECORD THREAD ONLY
+// writes frames until recording stops and none are left
+void record_loop() {
+	while(true) {
+		RecordFrame frame;
+		bool has_frame = false;
+		{
+			std::unique_lock<std::mutex> lock(record_mutex);
+			record_cv.wait(lock, [&] { return (has_frame = ready_records.pop(frame)) || !is_recording; });
+		}
+		if(!has_frame)
+			break;
+
+		if(!record_failed && !write_record_frame(frame))
+			record_failed = true;
+
+		free_records.push(frame.cells);
+		std::lock_guard<std::mutex> lock(record_mutex);
+		record_cv.notify_all();
+	}
+}
+
+// records the current generation too
+void start_recording() {
+	if(my_rank == ROOT_RANK) {
+		if(cfg->record_format == "gif") {
+			// as fast as graphic mode would show them, browsers slow down anything under 2
+			int delay = std::max(2, (int)std::lround(100.0 / std::max(cfg->max_frame_rate, 1)));
+			if(!gif_writer.open(cfg->record_path, tot_inner_cols, tot_inner_rows, cfg->floor_color, cfg->wall_color, delay)) {
+				std::cout << "Failed to open " << cfg->record_path << std::endl;
+				exit();
+			}
+		}
+		else if(cfg->record_format == "cave") {
+			if(!cave_writer.open(cfg->record_path, tot_inner_rows, tot_inner_cols, cfg->record_keyframe_interval)) {
+				std::cout << "Failed to open " << cfg->record_path << std::endl;
+				exit();
+			}
+		}
+		else std::filesystem::create_directories(cfg->record_path);
+
+		for(int i = 0; i < RECORD_POOL_SIZE; i++) {
+			record_pool[i] = new uint8_t[tot_inner_rows * tot_inner_cols];
+			free_records.push(record_pool[i]);
+		}
+		is_recording = true;
+		record_thread = std::thread(record_loop);
+	}
+
+	if(is_computing_process)
+		record_generation();
+}
+
+// COMPUTING PROCESSES ONLY
+void record_generation() {
+	double record_start_time = MPI_Wtime();
+	uint8_t* cells = nullptr;
+	if(my_rank == ROOT_RANK) {
+		if(record_failed) {
+			std::cout << "Failed to write the recording to " << cfg->record_path << std::endl;
+			exit();
+		}
+		// waits only if the record thread has every buffer
+		std::unique_lock<std::mutex> lock(record_mutex);
+		record_cv.wait(lock, [&] { return free_records.pop(cells); });
+	}
+
+	gather_whole_grid(cells);
+
+	if(my_rank == ROOT_RANK) {
+		ready_records.push({ cells, generation });
+		std::lock_guard<std::mutex> lock(record_mutex);
+		record_cv.notify_all();
+	}
+	record_time += MPI_Wtime() - record_start_time;
+}
+
+// waits for the record thread to write every frame left
+void stop_recording() {
+	if(my_rank != ROOT_RANK)
+		return;
+
+	double record_start_time = MPI_Wtime();
+	{
+		std::lock_guard<std::mutex> lock(record_mutex);
+		is_recording = false;
+	}
+	record_cv.notify_all();
+	record_thread.join();
+	gif_writer.close();
+	if(!cave_writer.close())
+		record_failed = true;
+	for(int i = 0; i < RECORD_POOL_SIZE; i++)
+		delete[] record_pool[i];
+	record_time += MPI_Wtime() - record_start_time;
+
+	if(record_failed)
+		std::cout << "Failed to write the recording to " << cfg->record_path << std::endl;
+	else std::cout << "Recording written to " << cfg->record_path << std::endl;
+}
+
+
+
+/*
+ * ==================================================================================
+ *  --------------------------------------------------------------------------------
+ *  								PLAYBACK
+ *  --------------------------------------------------------------------------------
+ * ==================================================================================
+ */
+
+// value of each lod_block x lod_block block, the same as lod_build_view gives it
+void playback_build_view(const uint8_t* cells, uint8_t* view_cells) {
+	bool majority = cfg->lod_mode == "majority";
+	for(int bi = 0; bi < view_rows; bi++) {
+		for(int bj = 0; bj < view_cols; bj++) {
+			int walls = 0;
+			int last_row = std::min((bi + 1) * lod_block, tot_inner_rows);
+			int last_col = std::min((bj + 1) * lod_block, tot_inner_cols);
+			for(int i = bi * lod_block; i < last_row; i++)
+				for(int j = bj * lod_block; j < last_col; j++)
+					walls += cells[i * tot_inner_cols + j];
+
+			// the same rule as the live view, so a generation looks the same in both
+			int block_cells = std::max(0, last_row - bi * lod_block) * std::max(0, last_col - bj * lod_block);
+			view_cells[bi * view_cols + bj] = lod_block_value(walls, block_cells, majority);
+		}
+	}
+}
+
+/**
+ * shows a recording made with record_format "cave", one frame every timer tick.
+ * space pauses, left and right step back and forth, home and end jump to the first and last frame.
+ * stepping back decodes from the keyframe before, nothing is computed again
+ */
+int playback(int argc, char const* argv[]) {
+	get_config_file_path(argc, argv);
+	read_config();
+	get_arg_configs(argc, argv);
+
+	CaveRecordReader reader;
+	if(!reader.open(play_file_path)) {
+		std::cout << "Failed to open recording " << play_file_path << std::endl;
+		return 1;
+	}
+	tot_inner_rows = reader.rows();
+	tot_inner_cols = reader.cols();
+
+	// the same level of detail as graphic mode, but fixed
+	lod_block = cfg->lod;
+	if(lod_block < 1) {
+		lod_block = 1;
+		while((long long)ceil_div(tot_inner_rows, lod_block) * ceil_div(tot_inner_cols, lod_block) > MAX_GRAPHIC_CELLS)
+			lod_block++;
+	}
+	max_lod_block = lod_block;
+	view_rows = ceil_div(tot_inner_rows, lod_block);
+	view_cols = ceil_div(tot_inner_cols, lod_block);
+	if((long long)view_rows * view_cols > MAX_GRAPHIC_CELLS) {
+		std::cout << "Recording is too large to show with lod " << lod_block << std::endl;
+		return 1;
+	}
+
+	// recordings have no edges
+	cfg->draw_edges = false;
+	DISPLAY_WIDTH = view_cols * cfg->cell_width;
+	DISPLAY_HEIGHT = view_rows * cfg->cell_height;
+	create_display();
+
+	uint8_t* cells = new uint8_t[tot_inner_rows * tot_inner_cols];
+	uint8_t* view_cells = lod_block > 1 ? new uint8_t[view_rows * view_cols] : nullptr;
+	Frame frame = { lod_block > 1 ? view_cells : cells, { 0, 0, lod_block }, 0 };
+
+	int last_frame = reader.frames() - 1;
+	int frame_number = 0;
+	int shown_frame = -1;
+	bool is_paused = false;
+	bool is_playing = true;
+	while(is_playing) {
+		ALLEGRO_EVENT event;
+		al_wait_for_event(queue, &event);
+
+		if(event.type == ALLEGRO_EVENT_DISPLAY_CLOSE)
+			is_playing = false;
+		else if(event.type == ALLEGRO_EVENT_DISPLAY_EXPOSE || event.type == ALLEGRO_EVENT_DISPLAY_SWITCH_IN
+			|| event.type == ALLEGRO_EVENT_DISPLAY_FOUND)
+			redraw_display();
+		else if(event.type == ALLEGRO_EVENT_KEY_CHAR) {
+			switch(event.keyboard.keycode) {
+			case ALLEGRO_KEY_ESCAPE: is_playing = false; break;
+			case ALLEGRO_KEY_SPACE: is_paused = !is_paused; break;
+			case ALLEGRO_KEY_RIGHT: is_paused = true; frame_number = std::min(frame_number + 1, last_frame); break;
+			case ALLEGRO_KEY_LEFT: is_paused = true; frame_number = std::max(frame_number - 1, 0); break;
+			case ALLEGRO_KEY_HOME: frame_number = 0; break;
+			case ALLEGRO_KEY_END: frame_number = last_frame; break;
+			}
+		}
+		else if(event.type == ALLEGRO_EVENT_TIMER) {
+			if(frame_number != shown_frame) {
+				int frame_generation;
+				if(!reader.read_frame(frame_number, cells, frame_generation)) {
+					std::cout << "Recording " << play_file_path << " is corrupt at frame " << frame_number << std::endl;
+					break;
+				}
+
+				bool grid_changed;
+				if(lod_block > 1) {
+					playback_build_view(cells, view_cells);
+					grid_changed = lod_draw_grid(view_cells);
+				}
+				else grid_changed = full_draw_grid(cells);
+				present_grid(&frame, grid_changed);
+
+				std::string title = "cave generator - generation " + std::to_string(frame_generation);
+				al_set_window_title(display, title.c_str());
+				shown_frame = frame_number;
+			}
+			if(!is_paused && frame_number < last_frame)
+				frame_number++;
+		}
+	}
+
+	delete[] cells;
+	delete[] view_cells;
+	destroy_display();
+	delete cfg;
+	return 0;
+}
+
+
+
+/*
  * ==================================================================================
  *  --------------------------------------------------------------------------------
  *  							PARALLEL COMUNICATION
@@ -680,16 +2102,11 @@ void parallel_initialize_random_grid() {
 		std::cout << "Random seed: " << seed << std::endl;
 	}
 
-	root_grid = new uint8_t[inner_grid_size * n_procs];
+	root_grid = new uint8_t[tot_inner_rows * tot_inner_cols];
 
 
-	for(int proc = 0; proc < n_procs; proc++) {
-		for(int i = 0; i < my_inner_rows; i++) {
-			for(int j = 0; j < my_inner_cols; j++) {
-				int idx = (proc * inner_grid_size) + (i * my_inner_cols) + j;
-				root_grid[idx] = (rand() % 100) < cfg->initial_fill_perc;
-			}
-		}
+	for(int i = 0; i < tot_inner_rows * tot_inner_cols; i++) {
+		root_grid[i] = (rand() % 100) < cfg->initial_fill_perc;
 	}
 
 
@@ -698,12 +2115,14 @@ void parallel_initialize_random_grid() {
 void scatter_initial_grid() {
 	// root sends initial grid to all other processes
 	uint8_t* dest_buff = &read_grid[(my_cols * radius) + radius];
-	MPI_Scatter(root_grid, 1, contiguous_grid_t, dest_buff, 1, inner_grid_t, ROOT_RANK, cave_comm);
+	MPI_Scatterv(root_grid, tile_counts, tile_displs, global_tile_t, dest_buff, 1, inner_grid_t, ROOT_RANK, cave_comm);
 }
 
-void gather_grid() {
-	uint8_t* send_buff = &read_grid[(my_cols * radius) + radius];
-	MPI_Gather(send_buff, 1, inner_grid_t, root_grid, 1, contiguous_grid_t, ROOT_RANK, cave_comm);
+// tiles land straight in their place in the row-major dest_grid, no remapping needed
+void gather_grid(uint8_t* dest_grid) {
+	uint8_t* send_buff = is_computing_process ? &read_grid[(my_cols * radius) + radius] : nullptr;
+	MPI_Gatherv(send_buff, is_computing_process, inner_grid_t,
+		dest_grid, tile_counts, tile_displs, global_tile_t, display_rank, display_comm);
 }
 
 
@@ -714,6 +2133,21 @@ void gather_grid() {
 #define RIGHT 2
 
 
+// bytes my halo exchange sends in a generation
+int halo_bytes_per_generation() {
+	int bytes = 0;
+	for(int i = TOP; i <= BOTTOM; i++) {
+		for(int j = LEFT; j <= RIGHT; j++) {
+			if((i == MIDDLE && j == MIDDLE) || neighbours_ranks[i][j] == MPI_PROC_NULL)
+				continue;
+			int type_size;
+			MPI_Type_size(i == MIDDLE ? column_t : j == MIDDLE ? row_t : corner_t, &type_size);
+			bytes += type_size;
+		}
+	}
+	return bytes;
+}
+
 void send_columns() {
 	if(neighbours_ranks[MIDDLE][LEFT] != MPI_PROC_NULL) {
 		MPI_Request req;
@@ -833,7 +2267,379 @@ void receive_corners() {
 
 
 
-void write_header(std::ofstream& file) {
+/*
+ * ==================================================================================
+ *  --------------------------------------------------------------------------------
+ *  								BENCHMARK
+ *  --------------------------------------------------------------------------------
+ * ==================================================================================
+ */
+
+// one grid, radius and layout of the sweep
+struct BenchCase {
+	int cols, rows, radius;
+	BenchLayout layout;
+	// untimed generations, then trials of generations each
+	int warmup_generations, trials, generations;
+};
+
+void check_bench_settings() {
+	if(cfg->bench_mode != "strong" && cfg->bench_mode != "weak") {
+		std::cout << "bench_mode must be either \"strong\" or \"weak\"" << std::endl;
+		exit();
+	}
+	if(cfg->bench_trials < 1 || cfg->bench_generations < 1 || cfg->bench_warmup_generations < 0) {
+		std::cout << "bench_trials and bench_generations must be at least 1, bench_warmup_generations at least 0" << std::endl;
+		exit();
+	}
+	for(auto& size : cfg->bench_sizes) {
+		if(size.first < 1 || size.second < 1) {
+			std::cout << "bench_sizes must be {cols, rows} pairs of at least 1" << std::endl;
+			exit();
+		}
+	}
+	for(int bench_radius : cfg->bench_radii) {
+		if(bench_radius < 1) {
+			std::cout << "bench_radii must be at least 1" << std::endl;
+			exit();
+		}
+	}
+}
+
+// halo exchange and update of a generation, only the exchange if bench_halo_only.
+// returns the time the halo exchange took
+double bench_generation() {
+	double comms_start_time = MPI_Wtime();
+	send_columns();
+	send_rows();
+	send_corners();
+	receive_columns();
+	receive_rows();
+	receive_corners();
+	double halo_time = MPI_Wtime() - comms_start_time;
+
+	if(!cfg->bench_halo_only) {
+		update_grid();
+		std::swap(read_grid, write_grid);
+	}
+	return halo_time;
+}
+
+/**
+ * COLLECTIVE
+ * runs a case on the first processes of the world, the others wait for the next case.
+ * ROOT ONLY, seconds and communication seconds per generation of every trial, of the slowest process,
+ * and the bytes all the processes send in a generation's halo exchange
+ */
+void run_bench_case(const BenchCase& bench_case, std::vector<double>& seconds, std::vector<double>& communication_seconds,
+	double& halo_bytes) {
+	cfg->x_threads = bench_case.layout.x_threads;
+	cfg->y_threads = bench_case.layout.y_threads;
+	tot_inner_rows = bench_case.rows;
+	tot_inner_cols = bench_case.cols;
+	radius = bench_case.radius;
+	my_inner_rows = tot_inner_rows / cfg->y_threads;
+	my_inner_cols = tot_inner_cols / cfg->x_threads;
+	my_rows = my_inner_rows + 2 * radius;
+	my_cols = my_inner_cols + 2 * radius;
+	inner_grid_size = my_inner_rows * my_inner_cols;
+	outer_grid_size = my_rows * my_cols;
+
+	int procs = cfg->x_threads * cfg->y_threads;
+	MPI_Comm bench_comm;
+	MPI_Comm_split(MPI_COMM_WORLD, my_rank < procs ? 0 : MPI_UNDEFINED, my_rank, &bench_comm);
+	if(bench_comm == MPI_COMM_NULL)
+		return;
+	create_cave_topology(bench_comm);
+	double my_halo_bytes = halo_bytes_per_generation();
+	MPI_Reduce(&my_halo_bytes, &halo_bytes, 1, MPI_DOUBLE, MPI_SUM, ROOT_RANK, cave_comm);
+
+	// walls all around like in a real run, random inside
+	srand(cfg->rand_seed + my_rank);
+	read_grid = new uint8_t[outer_grid_size];
+	write_grid = new uint8_t[outer_grid_size];
+	std::fill_n(read_grid, outer_grid_size, 1);
+	for(int i = radius; i < my_rows - radius; i++)
+		for(int j = radius; j < my_cols - radius; j++)
+			read_grid[at(i, j)] = (rand() % 100) < cfg->initial_fill_perc;
+	std::copy_n(read_grid, outer_grid_size, write_grid);
+
+	for(int g = 0; g < bench_case.warmup_generations; g++)
+		bench_generation();
+
+	for(int trial = 0; trial < bench_case.trials; trial++) {
+		MPI_Barrier(cave_comm);
+		double trial_start_time = MPI_Wtime();
+		double trial_times[2] = { 0, 0 };
+		for(int g = 0; g < bench_case.generations; g++)
+			trial_times[1] += bench_generation();
+		trial_times[0] = MPI_Wtime() - trial_start_time;
+
+		double slowest_times[2];
+		MPI_Reduce(trial_times, slowest_times, 2, MPI_DOUBLE, MPI_MAX, ROOT_RANK, cave_comm);
+		if(my_rank == ROOT_RANK) {
+			seconds.push_back(slowest_times[0] / bench_case.generations);
+			communication_seconds.push_back(slowest_times[1] / bench_case.generations);
+		}
+	}
+
+	delete[] read_grid;
+	delete[] write_grid;
+	free_cave_topology();
+	MPI_Comm_free(&bench_comm);
+}
+
+/**
+ * COLLECTIVE
+ * every grid size and radius on every layout of up to bench_max_procs processes.
+ * the sizes are fixed in strong mode, rounded down to a multiple of the layout so none is skipped,
+ * and are the tile of every process in weak mode.
+ * root writes every trial to bench_file_path and prints the mean with its 95% confidence interval.
+ * with bench_halo_only the sizes are best given as tiles, in weak mode, to see how the exchange grows with them
+ */
+void run_bench() {
+	int world_size;
+	MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+	bool is_weak = cfg->bench_mode == "weak";
+
+	std::vector<std::pair<int, int>> sizes = cfg->bench_sizes;
+	if(sizes.empty())
+		sizes.push_back({ cfg->cols, cfg->rows });
+	std::vector<int> radii = cfg->bench_radii;
+	if(radii.empty())
+		radii.push_back(cfg->neighbour_radius);
+	int max_procs = cfg->bench_max_procs > 0 ? std::min(cfg->bench_max_procs, world_size) : world_size;
+	std::vector<BenchLayout> layouts = bench_layouts(max_procs);
+
+	std::ofstream file;
+	if(my_rank == ROOT_RANK) {
+		file.open(cfg->bench_file_path);
+		if(!file.is_open()) {
+			std::cout << "Failed to open " << cfg->bench_file_path << std::endl;
+			exit();
+		}
+		file << "mode,halo_only,cols,rows,radius,y_threads,x_threads,procs,trial,generations,"
+			<< "seconds_per_generation,communication_seconds_per_generation,cell_updates_per_second,"
+			<< "halo_bytes_per_generation,halo_bytes_per_second" << std::endl;
+
+		std::cout << "Benchmark" << (cfg->bench_halo_only ? " of the halo exchange only" : "") << ", "
+			<< cfg->bench_mode << " scaling on up to " << max_procs << " processes, "
+			<< cfg->bench_trials << " trials of " << cfg->bench_generations << " generations after "
+			<< cfg->bench_warmup_generations << " warm-up generations" << std::endl;
+		std::cout << std::setw(12) << "grid" << std::setw(8) << "radius" << std::setw(8) << "layout"
+			<< std::setw(14) << "s/generation" << std::setw(28) << "95% CI";
+		if(cfg->bench_halo_only)
+			std::cout << std::setw(14) << "bytes/gen" << std::setw(12) << "MB/s" << std::endl;
+		else std::cout << std::setw(8) << "comm" << std::setw(10) << (is_weak ? "scaled" : "speedup") << std::setw(12) << "efficiency" << std::endl;
+	}
+
+	// strong scaling grids are cut down to a multiple of the layout, so speedups compare cell updates per second
+	bool is_any_grid_rounded = false;
+	for(auto& size : sizes) {
+		for(int bench_radius : radii) {
+			// layouts start from a single process, the reference of the others
+			double single_process_cell_updates = 0;
+			for(const BenchLayout& layout : layouts) {
+				BenchCase bench_case;
+				bench_case.layout = layout;
+				bench_case.radius = bench_radius;
+				bench_case.warmup_generations = cfg->bench_warmup_generations;
+				bench_case.trials = cfg->bench_trials;
+				bench_case.generations = cfg->bench_generations;
+				if(is_weak) {
+					bench_case.cols = size.first * layout.x_threads;
+					bench_case.rows = size.second * layout.y_threads;
+				}
+				else {
+					bench_case.cols = size.first - size.first % layout.x_threads;
+					bench_case.rows = size.second - size.second % layout.y_threads;
+				}
+				// the halo of a tile can't be wider than the tile
+				if(bench_case.cols / layout.x_threads < bench_radius || bench_case.rows / layout.y_threads < bench_radius)
+					continue;
+
+				std::vector<double> seconds, communication_seconds;
+				double halo_bytes = 0;
+				run_bench_case(bench_case, seconds, communication_seconds, halo_bytes);
+				if(my_rank != ROOT_RANK)
+					continue;
+
+				int procs = layout.x_threads * layout.y_threads;
+				double cells = (double)bench_case.cols * bench_case.rows;
+				for(int trial = 0; trial < (int)seconds.size(); trial++) {
+					file << cfg->bench_mode << "," << cfg->bench_halo_only << "," << bench_case.cols << "," << bench_case.rows << ","
+						<< bench_radius << "," << layout.y_threads << "," << layout.x_threads << "," << procs << "," << trial << ","
+						<< cfg->bench_generations << "," << seconds[trial] << "," << communication_seconds[trial] << ",";
+					// no cell is updated when only the halo is exchanged
+					if(!cfg->bench_halo_only)
+						file << cells / seconds[trial];
+					file << "," << halo_bytes << ",";
+					if(communication_seconds[trial] > 0)
+						file << halo_bytes / communication_seconds[trial];
+					file << std::endl;
+				}
+
+				BenchSummary summary = summarize_bench(seconds);
+				BenchSummary communication_summary = summarize_bench(communication_seconds);
+				double cell_updates = cells / summary.mean;
+				if(procs == 1)
+					single_process_cell_updates = cell_updates;
+				// strong: the same grid, weak: the same tile per process, so procs times the work of a single one
+				double speedup = single_process_cell_updates > 0 ? cell_updates / single_process_cell_updates : 0;
+				bool is_grid_rounded = !is_weak && (bench_case.cols != size.first || bench_case.rows != size.second);
+				is_any_grid_rounded = is_any_grid_rounded || is_grid_rounded;
+				std::ostringstream grid, layout_name, interval;
+				grid << bench_case.cols << "x" << bench_case.rows << (is_grid_rounded ? "*" : "");
+				layout_name << layout.x_threads << "x" << layout.y_threads;
+				interval << std::setprecision(4) << "[" << summary.ci_low << ", " << summary.ci_high << "]";
+				std::cout << std::setw(12) << grid.str() << std::setw(8) << bench_radius << std::setw(8) << layout_name.str()
+					<< std::setw(14) << summary.mean << std::setw(28) << interval.str();
+				if(cfg->bench_halo_only) {
+					// every process exchanges at once, so that's the bandwidth the whole machine sustains
+					double bandwidth = communication_summary.mean > 0 ? halo_bytes / communication_summary.mean / 1e6 : 0;
+					std::cout << std::setw(14) << halo_bytes << std::setw(12) << bandwidth << std::endl;
+					continue;
+				}
+				std::cout << std::setw(7) << (int)std::round(100 * communication_summary.mean / summary.mean) << "%"
+					<< std::setw(10) << speedup << std::setw(12) << speedup / procs << std::endl;
+			}
+		}
+	}
+
+	if(my_rank == ROOT_RANK) {
+		if(is_any_grid_rounded && !cfg->bench_halo_only)
+			std::cout << "* grid cut down to a multiple of the layout, its speedup compares cell updates per second" << std::endl;
+		std::cout << "Trials written to " << cfg->bench_file_path << std::endl;
+	}
+}
+
+
+// trial of every layout auto_decompose measures
+#define AUTO_DECOMPOSE_WARMUP_GENERATIONS 2
+#define AUTO_DECOMPOSE_TRIALS 3
+
+// ROOT ONLY, layouts picked before on this host for the same grid, radius and processes
+std::string auto_decompose_key(int procs) {
+	char host[MPI_MAX_PROCESSOR_NAME];
+	int host_length;
+	MPI_Get_processor_name(host, &host_length);
+	std::ostringstream key;
+	key << std::string(host, host_length) << "/" << cfg->cols << "x" << cfg->rows
+		<< "/radius " << (int)cfg->neighbour_radius << "/" << procs << " procs";
+	return key.str();
+}
+
+json read_decompose_cache() {
+	std::ifstream file(cfg->decompose_cache_path);
+	if(!file.is_open())
+		return json::object();
+	json cache = json::parse(file, nullptr, false);
+	return cache.is_object() ? cache : json::object();
+}
+
+/**
+ * COLLECTIVE
+ * picks x_threads and y_threads among the layouts that split the grid evenly over the computing processes.
+ * every layout runs a few generations of the real grid and the fastest wins,
+ * the choice is cached in decompose_cache_path so the next run on this host skips the trials
+ */
+void auto_decompose() {
+	int world_size;
+	MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+	int procs = cfg->render_rank ? world_size - 1 : world_size;
+	int cave_radius = cfg->neighbour_radius;
+	if(cfg->auto_decompose_generations < 1) {
+		if(my_rank == ROOT_RANK)
+			std::cout << "auto_decompose_generations must be at least 1" << std::endl;
+		exit();
+	}
+
+	std::vector<BenchLayout> layouts;
+	for(const BenchLayout& layout : bench_layouts(procs)) {
+		if(layout.x_threads * layout.y_threads == procs && cfg->cols % layout.x_threads == 0 && cfg->rows % layout.y_threads == 0
+			&& cfg->cols / layout.x_threads >= cave_radius && cfg->rows / layout.y_threads >= cave_radius)
+			layouts.push_back(layout);
+	}
+	if(layouts.empty()) {
+		if(my_rank == ROOT_RANK)
+			std::cout << "No layout of " << procs << " processes splits " << cfg->cols << "x" << cfg->rows << " evenly" << std::endl;
+		exit();
+	}
+
+	// x_threads, y_threads, 0 if not cached
+	int choice[2] = { 0, 0 };
+	std::string key;
+	if(my_rank == ROOT_RANK) {
+		key = auto_decompose_key(procs);
+		json cache = read_decompose_cache();
+		if(cache.contains(key)) {
+			int x_threads = cache[key].value("x_threads", 0);
+			int y_threads = cache[key].value("y_threads", 0);
+			for(const BenchLayout& layout : layouts) {
+				if(layout.x_threads == x_threads && layout.y_threads == y_threads) {
+					choice[0] = x_threads;
+					choice[1] = y_threads;
+				}
+			}
+		}
+	}
+	MPI_Bcast(choice, 2, MPI_INT, ROOT_RANK, MPI_COMM_WORLD);
+	if(choice[0] > 0) {
+		cfg->x_threads = choice[0];
+		cfg->y_threads = choice[1];
+		if(my_rank == ROOT_RANK)
+			std::cout << "Layout " << cfg->x_threads << "x" << cfg->y_threads << " from " << cfg->decompose_cache_path << std::endl;
+		return;
+	}
+
+	if(my_rank == ROOT_RANK)
+		std::cout << "Trying " << layouts.size() << " layouts of " << procs << " processes:" << std::endl;
+	double best_seconds = 0;
+	for(const BenchLayout& layout : layouts) {
+		BenchCase bench_case;
+		bench_case.cols = cfg->cols;
+		bench_case.rows = cfg->rows;
+		bench_case.radius = cave_radius;
+		bench_case.layout = layout;
+		bench_case.warmup_generations = AUTO_DECOMPOSE_WARMUP_GENERATIONS;
+		bench_case.trials = AUTO_DECOMPOSE_TRIALS;
+		bench_case.generations = cfg->auto_decompose_generations;
+
+		std::vector<double> seconds, communication_seconds;
+		double halo_bytes;
+		run_bench_case(bench_case, seconds, communication_seconds, halo_bytes);
+		if(my_rank != ROOT_RANK)
+			continue;
+
+		// the best trial, the others had more noise
+		double layout_seconds = *std::min_element(seconds.begin(), seconds.end());
+		std::cout << std::setw(8) << std::to_string(layout.x_threads) + "x" + std::to_string(layout.y_threads)
+			<< std::setw(14) << layout_seconds << " s/generation" << std::endl;
+		if(choice[0] == 0 || layout_seconds < best_seconds) {
+			best_seconds = layout_seconds;
+			choice[0] = layout.x_threads;
+			choice[1] = layout.y_threads;
+		}
+	}
+	MPI_Bcast(choice, 2, MPI_INT, ROOT_RANK, MPI_COMM_WORLD);
+	cfg->x_threads = choice[0];
+	cfg->y_threads = choice[1];
+	if(my_rank != ROOT_RANK)
+		return;
+
+	std::cout << "Using layout " << cfg->x_threads << "x" << cfg->y_threads << std::endl;
+	json cache = read_decompose_cache();
+	cache[key] = { { "x_threads", cfg->x_threads }, { "y_threads", cfg->y_threads }, { "seconds_per_generation", best_seconds } };
+	std::ofstream file(cfg->decompose_cache_path);
+	if(file.is_open())
+		file << cache.dump(4) << std::endl;
+	else std::cout << "Failed to write " << cfg->decompose_cache_path << ", the layout won't be cached" << std::endl;
+}
+
+
+void write_header(std::ostream& file) {
 	std::string separator = ",";
 	file << "total_time" << separator
 		<< "communication_time" << separator
@@ -850,19 +2656,63 @@ void write_header(std::ofstream& file) {
 		<< "rows" << separator
 		<< "radius" << separator
 		<< "roughness" << separator
-		<< "config_file_path" << std::endl;
-		// << "config_file_path" << separator
-		// << "frame_timings" << std::endl;
+		<< "config_file_path";
+	for(std::string phase : { "halo", "update", "generation" })
+		for(std::string statistic : { "min", "p50", "p95", "p99", "max" })
+			file << separator << phase << "_" << statistic;
+	for(std::string phase : { "communication", "generation", "draw" })
+		for(std::string statistic : { "min", "avg", "max", "max_rank", "imbalance" })
+			file << separator << phase << "_time_" << statistic;
+	file << separator << "generations"
+		<< separator << "cell_updates_per_second"
+		<< separator << "cell_updates_per_second_per_process"
+		<< separator << "halo_bytes"
+		<< separator << "halo_bytes_per_second"
+		<< separator << "speedup"
+		<< separator << "efficiency"
+		<< separator << "peak_rss_min_kb"
+		<< separator << "peak_rss_avg_kb"
+		<< separator << "peak_rss_max_kb"
+		<< separator << "peak_rss_max_rank";
+	for(std::string phase : { "update", "halo", "draw" })
+		for(int c = 0; c < PERF_COUNTERS; c++)
+			file << separator << phase << "_" << perf_counter_name(c);
+	file << std::endl;
+}
+
+// ROOT ONLY, rows are only appended to a results file written with the same columns
+void check_results_settings() {
+	std::ifstream file(cfg->results_file_path);
+	std::string file_header;
+	if(!file.is_open() || !std::getline(file, file_header))
+		return;
+	if(!file_header.empty() && file_header.back() == '\r')
+		file_header.pop_back();
+
+	std::ostringstream header;
+	write_header(header);
+	if(file_header + "\n" != header.str()) {
+		std::cout << "Results file " << cfg->results_file_path << " has different columns than this version writes" << std::endl;
+		std::cout << "move it away or pick another results file with -o" << std::endl;
+		exit();
+	}
 }
 
+void write_phase_balance(std::ostream& os, const PhaseBalance& balance, const std::string& separator) {
+	os << separator << balance.min
+		<< separator << balance.avg
+		<< separator << balance.max
+		<< separator << balance.max_rank
+		<< separator << balance.imbalance;
+}
 
-// void print_frame_times(std::ostream& os) {
-// 	os << '[';
-// 	for(int i = 0; i < cfg->last_generation; i++) {
-// 		os << frame_times[i] << ' ';
-// 	}
-// 	os << ']';
-// }
+void write_latency_summary(std::ostream& os, const LatencySummary& summary, const std::string& separator) {
+	os << separator << summary.min
+		<< separator << summary.p50
+		<< separator << summary.p95
+		<< separator << summary.p99
+		<< separator << summary.max;
+}
 
 void write_result(std::ofstream& file) {
 	std::string separator = ",";
@@ -881,14 +2731,50 @@ void write_result(std::ofstream& file) {
 		<< cfg->rows << separator
 		<< (int)cfg->neighbour_radius << separator
 		<< cfg->roughness << separator
-		<< config_file_path << std::endl;
-	// print_frame_times(file);
-
-	// file << std::endl;
+		<< config_file_path;
+	write_latency_summary(file, halo_summary, separator);
+	write_latency_summary(file, update_summary, separator);
+	write_latency_summary(file, generation_summary, separator);
+	write_phase_balance(file, communication_balance, separator);
+	write_phase_balance(file, generation_balance, separator);
+	write_phase_balance(file, draw_balance, separator);
+	file << separator << generation - first_generation
+		<< separator << cell_updates_per_second
+		<< separator << cell_updates_per_second / n_procs
+		<< separator << halo_bytes
+		<< separator << halo_bytes_per_second
+		<< separator;
+	// left empty without a serial baseline
+	if(speedup > 0)
+		file << speedup << separator << efficiency;
+	else file << separator;
+	file << separator << peak_rss_balance.min
+		<< separator << peak_rss_balance.avg
+		<< separator << peak_rss_balance.max
+		<< separator << peak_rss_balance.max_rank;
+	// left empty when not measured
+	for(int phase = 0; phase < 3; phase++) {
+		for(int c = 0; c < PERF_COUNTERS; c++) {
+			file << separator;
+			if(perf_totals[phase][c] >= 0)
+				file << std::fixed << std::setprecision(0) << perf_totals[phase][c] << std::defaultfloat << std::setprecision(6);
+		}
+	}
+	file << std::endl;
 }
 
 
 
+bool get_play_file_path(int argc, char const* argv[]) {
+	for(int i = 0; i < argc; i++) {
+		if(argv[i] == std::string("-play") && i + 1 < argc) {
+			play_file_path = argv[i + 1];
+			return true;
+		}
+	}
+	return false;
+}
+
 void get_config_file_path(int argc, char const* argv[]) {
 	for(int i = 0; i < argc; i++) {
 		if((argv[i] == std::string("-c") || argv[i] == std::string("--config")) && i + 1 < argc) {
@@ -898,14 +2784,501 @@ void get_config_file_path(int argc, char const* argv[]) {
 	}
 }
 
+void read_config() {
+	try {
+		cfg = new Config(config_file_path);
+	}
+	catch(const json::exception& e) {
+		std::cout << "Failed to read config file " << config_file_path << ": " << e.what() << std::endl;
+		exit();
+	}
+}
+
+// my inner cells in the whole grid
+GridTile my_grid_tile() {
+	return { tot_inner_rows, tot_inner_cols, my_first_row, my_first_col, my_inner_rows, my_inner_cols };
+}
+
+void check_save_settings() {
+	// png has no tile layout to check, the tiles are deflated in bands of rows
+	if(cfg->save_format == "png")
+		return;
+	GridFormat format = GRID_RAW;
+	if(!grid_format_from_name(cfg->save_format, format)) {
+		std::cout << "save_format must be \"raw\", \"pgm\", \"pbm\" or \"png\"" << std::endl;
+		exit();
+	}
+	if(!grid_tile_fits(format, my_grid_tile())) {
+		std::cout << "pbm packs 8 cells in a byte, cols / x_threads must be a multiple of 8" << std::endl;
+		exit();
+	}
+}
+
+/**
+ * every computing process writes its own tile with collective MPI-IO,
+ * the grid is never gathered on a single process
+ */
+void save_grid() {
+	double save_start_time = MPI_Wtime();
+	if(is_computing_process) {
+		MPI_Comm save_comm = cfg->is_parallel ? cave_comm : MPI_COMM_SELF;
+		const uint8_t* tile_cells = &read_grid[(my_cols * radius) + radius];
+		int err;
+		if(cfg->save_format == "png")
+			err = write_png_file(save_comm, cfg->save_file_path, my_grid_tile(), tile_cells, my_cols, cfg->floor_color, cfg->wall_color);
+		else {
+			GridFormat format = GRID_RAW;
+			grid_format_from_name(cfg->save_format, format);
+			err = write_grid_file(save_comm, cfg->save_file_path, format, my_grid_tile(), tile_cells, my_cols);
+		}
+		if(err != MPI_SUCCESS) {
+			std::cout << "Failed to save the grid to " << cfg->save_file_path << std::endl;
+			exit();
+		}
+	}
+	save_time = MPI_Wtime() - save_start_time;
+
+	if(my_rank == ROOT_RANK)
+		std::cout << "Grid saved to " << cfg->save_file_path << std::endl;
+}
+
+// the size of the grid comes from the file being loaded
+void load_grid_header() {
+	if(!read_grid_header(MPI_COMM_WORLD, cfg->load_file_path, load_file_info)) {
+		std::cout << "Failed to load the grid from " << cfg->load_file_path << std::endl;
+		std::cout << "it must be a raw, pgm or pbm file" << std::endl;
+		exit();
+	}
+	load_path = cfg->load_file_path;
+	cfg->rows = load_file_info.rows;
+	cfg->cols = load_file_info.cols;
+}
+
+/**
+ * every computing process reads its own tile and the halo around it with collective MPI-IO,
+ * so no halo exchange is needed before the first generation
+ */
+void load_grid() {
+	if(!is_computing_process)
+		return;
+
+	MPI_Comm load_comm = cfg->is_parallel ? cave_comm : MPI_COMM_SELF;
+	// serial has no halo, only the walls around the grid
+	int halo = cfg->is_parallel ? radius : 0;
+	int err = read_grid_file(load_comm, load_path, load_file_info, my_grid_tile(), halo,
+		&read_grid[(my_cols * radius) + radius], my_cols);
+	if(err == GRID_ERR_TRUNCATED) {
+		std::cout << "Failed to read the grid from " << load_path << ", the file is shorter than its header says" << std::endl;
+		exit();
+	}
+	if(err == GRID_ERR_BAD_CELL) {
+		std::cout << "Failed to read the grid from " << load_path << ", raw cells must be 0 or 1" << std::endl;
+		exit();
+	}
+	if(err != MPI_SUCCESS) {
+		std::cout << "Failed to read the grid from " << load_path << std::endl;
+		exit();
+	}
+}
+
+// the settings a checkpoint can only be restarted with
+uint64_t get_config_hash() {
+	int settings[] = { cfg->rows, cfg->cols, cfg->neighbour_radius, cfg->roughness };
+	return checkpoint_config_hash(settings, 4);
+}
+
+void check_checkpoint_settings() {
+	if(cfg->checkpoint_compress && !grid_tile_fits(GRID_PBM, my_grid_tile())) {
+		std::cout << "compressed checkpoints pack 8 cells in a byte, cols / x_threads must be a multiple of 8" << std::endl;
+		exit();
+	}
+}
+
+/**
+ * picks the newest complete checkpoint, the grid is loaded from it like with -load.
+ * the decomposition may differ from the one the checkpoint was written with
+ */
+void load_checkpoint_header() {
+	std::string latest_path;
+	CheckpointHeader latest = {};
+	for(int i = 0; i < 2; i++) {
+		std::string path = cfg->checkpoint_file_path + "." + std::to_string(i);
+		CheckpointHeader header;
+		if(read_checkpoint_header(MPI_COMM_WORLD, path, header) && (latest_path.empty() || header.generation > latest.generation)) {
+			latest = header;
+			latest_path = path;
+		}
+	}
+
+	if(latest_path.empty()) {
+		std::cout << "No checkpoint found at " << cfg->checkpoint_file_path << ".0 or .1" << std::endl;
+		exit();
+	}
+	if(latest.config_hash != get_config_hash()) {
+		std::cout << "Checkpoint " << latest_path << " was made with different cols, rows, neighbour_radius or roughness" << std::endl;
+		exit();
+	}
+	if(cfg->last_generation != 0 && latest.generation >= cfg->last_generation) {
+		std::cout << "Checkpoint " << latest_path << " is already at generation " << latest.generation << std::endl;
+		exit();
+	}
+	if(!read_grid_header(MPI_COMM_WORLD, latest_path, load_file_info, CHECKPOINT_HEADER_SIZE)) {
+		std::cout << "Failed to load the grid from " << latest_path << std::endl;
+		exit();
+	}
+
+	load_path = latest_path;
+	generation = latest.generation;
+	// ranks aren't known yet
+	int world_rank;
+	MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+	if(world_rank == ROOT_RANK)
+		std::cout << "Restarting from generation " << generation << " of " << latest_path << std::endl;
+}
+
+// COMPUTING PROCESSES ONLY
+void write_checkpoint() {
+	double checkpoint_start_time = MPI_Wtime();
+	MPI_Comm checkpoint_comm = cfg->is_parallel ? cave_comm : MPI_COMM_SELF;
+	std::string path = checkpoint_file_path(cfg->checkpoint_file_path, generation, cfg->checkpoint_interval);
+	int err = write_checkpoint_file(checkpoint_comm, path, generation, get_config_hash(), cfg->checkpoint_compress,
+		my_grid_tile(), &read_grid[(my_cols * radius) + radius], my_cols);
+	if(err != MPI_SUCCESS) {
+		std::cout << "Failed to write checkpoint " << path << std::endl;
+		exit();
+	}
+	checkpoint_time += MPI_Wtime() - checkpoint_start_time;
+}
+
+/**
+ * COLLECTIVE
+ * every process ran the same generations, so for each one root keeps the time of the slowest process.
+ * a generation is only as fast as its slowest tile
+ */
+void summarize_latencies() {
+	if(!is_computing_process)
+		return;
+
+	LatencySamples* phases[3] = { &halo_latency, &update_latency, &generation_latency };
+	LatencySummary* summaries[3] = { &halo_summary, &update_summary, &generation_summary };
+	for(int phase = 0; phase < 3; phase++) {
+		int count = phases[phase]->size();
+		double* samples = phases[phase]->data();
+		if(cfg->is_parallel)
+			MPI_Reduce(my_rank == ROOT_RANK ? MPI_IN_PLACE : samples, samples, count, MPI_DOUBLE, MPI_MAX, ROOT_RANK, cave_comm);
+		if(my_rank == ROOT_RANK)
+			*summaries[phase] = summarize_latency(samples, count);
+	}
+}
+
+// COLLECTIVE, the result is only valid on root
+PhaseBalance reduce_phase_balance(double time) {
+	if(!cfg->is_parallel)
+		return { time, time, time, ROOT_RANK, 1 };
+
+	struct { double time; int rank; } mine = { time, my_rank }, fastest, slowest;
+	double total;
+	MPI_Reduce(&mine, &fastest, 1, MPI_DOUBLE_INT, MPI_MINLOC, ROOT_RANK, cave_comm);
+	MPI_Reduce(&mine, &slowest, 1, MPI_DOUBLE_INT, MPI_MAXLOC, ROOT_RANK, cave_comm);
+	MPI_Reduce(&time, &total, 1, MPI_DOUBLE, MPI_SUM, ROOT_RANK, cave_comm);
+
+	double avg = total / n_procs;
+	return { fastest.time, avg, slowest.time, slowest.rank, avg > 0 ? slowest.time / avg : 1 };
+}
+
+/**
+ * COLLECTIVE
+ * a slow run can come from a single straggler, root gets the spread of every phase
+ * and the generation time of each process
+ */
+void summarize_balance() {
+	if(!is_computing_process)
+		return;
+
+	communication_balance = reduce_phase_balance(communication_time);
+	generation_balance = reduce_phase_balance(generation_time);
+	draw_balance = reduce_phase_balance(draw_time);
+
+	// ru_maxrss is in KB on linux
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	peak_rss_balance = reduce_phase_balance(usage.ru_maxrss);
+
+	double my_halo_bytes = cfg->is_parallel ? (double)halo_bytes_per_generation() * (generation - first_generation) : 0;
+	if(cfg->is_parallel)
+		MPI_Reduce(&my_halo_bytes, &halo_bytes, 1, MPI_DOUBLE, MPI_SUM, ROOT_RANK, cave_comm);
+
+	if(my_rank == ROOT_RANK)
+		process_generation_times.resize(n_procs);
+	MPI_Gather(&generation_time, 1, MPI_DOUBLE, process_generation_times.data(), 1, MPI_DOUBLE, ROOT_RANK,
+		cfg->is_parallel ? cave_comm : MPI_COMM_SELF);
+}
+
+/**
+ * ROOT ONLY
+ * fastest time per generation of a serial run (1 computing process) with the same cave,
+ * generations and graphic mode in the results file. false if there's none
+ */
+bool find_serial_baseline(double& baseline_seconds_per_generation) {
+	std::ifstream file(cfg->results_file_path);
+	std::string line;
+	if(!std::getline(file, line))
+		return false;
+
+	auto split = [](const std::string& line) {
+		std::vector<std::string> fields;
+		std::stringstream stream(line);
+		std::string field;
+		while(std::getline(stream, field, ','))
+			fields.push_back(field);
+		return fields;
+	};
+	// columns are found by name, older results files may not have all of them
+	std::vector<std::string> header = split(line);
+	auto column = [&](const std::string& name) {
+		return (int)(std::find(header.begin(), header.end(), name) - header.begin());
+	};
+	const std::string keys[] = { "cols", "rows", "radius", "roughness", "show_graphics", "generations" };
+	const std::string values[] = { std::to_string(cfg->cols), std::to_string(cfg->rows), std::to_string((int)cfg->neighbour_radius),
+		std::to_string(cfg->roughness), std::to_string(cfg->show_graphics), std::to_string(generation - first_generation) };
+	int total_time_column = column("total_time");
+	int n_procs_column = column("n_procs");
+
+	bool is_found = false;
+	while(std::getline(file, line)) {
+		std::vector<std::string> fields = split(line);
+		auto field = [&](int index) { return index < (int)fields.size() ? fields[index] : std::string(); };
+		bool is_match = field(n_procs_column) == "1";
+		for(int k = 0; k < 6 && is_match; k++)
+			is_match = field(column(keys[k])) == values[k];
+		if(!is_match || generation == first_generation)
+			continue;
+
+		double seconds_per_generation = std::stod(field(total_time_column)) / (generation - first_generation);
+		if(!is_found || seconds_per_generation < baseline_seconds_per_generation)
+			baseline_seconds_per_generation = seconds_per_generation;
+		is_found = true;
+	}
+	return is_found;
+}
+
+// ROOT ONLY
+void summarize_throughput() {
+	int generations = generation - first_generation;
+	cell_updates_per_second = total_time > 0 ? (double)tot_inner_rows * tot_inner_cols * generations / total_time : 0;
+	halo_bytes_per_second = communication_balance.avg > 0 ? halo_bytes / communication_balance.avg : 0;
+
+	double baseline_seconds_per_generation;
+	speedup = efficiency = 0;
+	if(!cfg->results_file_path.empty() && generations > 0 && find_serial_baseline(baseline_seconds_per_generation)) {
+		speedup = baseline_seconds_per_generation / (total_time / generations);
+		efficiency = speedup / n_procs;
+	}
+}
+
+void print_phase_balance(const std::string& phase, const PhaseBalance& balance) {
+	std::cout << std::left << std::setw(15) << phase << std::right << std::fixed << std::setprecision(4)
+		<< std::setw(10) << balance.min
+		<< std::setw(10) << balance.avg
+		<< std::setw(10) << balance.max
+		<< std::setw(10) << balance.max_rank
+		<< std::setprecision(2) << std::setw(11) << balance.imbalance << std::endl;
+	std::cout.unsetf(std::ios::floatfield);
+	std::cout << std::setprecision(6);
+}
+
+// generation time of each process laid out like the tiles, the slowest one is marked with *
+void print_process_table() {
+	std::cout << "Generation time per process (s), * is the slowest:" << std::endl;
+	std::cout << std::setw(6) << "";
+	for(int x = 0; x < cfg->x_threads; x++)
+		std::cout << std::setw(11) << "x=" + std::to_string(x);
+	std::cout << std::endl;
+
+	std::cout << std::fixed << std::setprecision(4);
+	for(int y = 0; y < cfg->y_threads; y++) {
+		std::cout << std::left << std::setw(6) << "y=" + std::to_string(y) << std::right;
+		for(int x = 0; x < cfg->x_threads; x++) {
+			int proc = y * cfg->x_threads + x;
+			std::cout << std::setw(10) << process_generation_times[proc] << (proc == generation_balance.max_rank ? '*' : ' ');
+		}
+		std::cout << std::endl;
+	}
+	std::cout.unsetf(std::ios::floatfield);
+	std::cout << std::setprecision(6);
+}
+
+void print_latency_summary(const std::string& phase, const LatencySummary& summary) {
+	std::cout << std::left << std::setw(12) << phase << std::right << std::fixed << std::setprecision(3)
+		<< std::setw(10) << summary.min * 1000
+		<< std::setw(10) << summary.p50 * 1000
+		<< std::setw(10) << summary.p95 * 1000
+		<< std::setw(10) << summary.p99 * 1000
+		<< std::setw(10) << summary.max * 1000 << std::endl;
+	std::cout.unsetf(std::ios::floatfield);
+	std::cout << std::setprecision(6);
+}
+
+/**
+ * COLLECTIVE
+ * every process traces from the same moment, the clocks of different nodes aren't in sync otherwise
+ */
+void start_tracing() {
+	size_t capacity = TRACE_MAX_EVENTS;
+	// one more for the starting generation, recorded before the first update
+	if(cfg->last_generation > generation)
+		capacity = std::min(capacity, (size_t)(cfg->last_generation - generation + 1) * TRACE_EVENTS_PER_GENERATION);
+	MPI_Barrier(MPI_COMM_WORLD);
+	tracer.allocate(capacity, MPI_Wtime());
+}
+
+/**
+ * COLLECTIVE
+ * opens the counters every process can, root says which ones are missing and why
+ */
+void start_perf_counters() {
+	perf_counters.open();
+	int available[PERF_COUNTERS];
+	for(int c = 0; c < PERF_COUNTERS; c++)
+		available[c] = perf_counters.is_available(c);
+	MPI_Allreduce(MPI_IN_PLACE, available, PERF_COUNTERS, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+
+	int world_procs;
+	MPI_Comm_size(MPI_COMM_WORLD, &world_procs);
+	if(my_rank != ROOT_RANK)
+		return;
+	std::string missing;
+	for(int c = 0; c < PERF_COUNTERS; c++)
+		if(available[c] < world_procs)
+			missing += std::string(missing.empty() ? "" : ", ") + perf_counter_name(c);
+	if(!missing.empty()) {
+		std::cout << "Performance counters not available on every process: " << missing << std::endl;
+		if(!perf_counters.error.empty())
+			std::cout << "(" << perf_counters.error << ")" << std::endl;
+	}
+}
+
+// COLLECTIVE, counters of every process are summed, the display process draws too
+void summarize_perf_counters() {
+	if(!cfg->perf_counters) {
+		for(int phase = 0; phase < 3; phase++)
+			std::fill_n(perf_totals[phase], PERF_COUNTERS, -1.0);
+		return;
+	}
+
+	PerfPhase* phases[3] = { &perf_update, &perf_halo, &perf_draw };
+	int available[PERF_COUNTERS];
+	for(int c = 0; c < PERF_COUNTERS; c++)
+		available[c] = perf_counters.is_available(c);
+	MPI_Allreduce(MPI_IN_PLACE, available, PERF_COUNTERS, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+	for(int phase = 0; phase < 3; phase++) {
+		MPI_Reduce(phases[phase]->totals, perf_totals[phase], PERF_COUNTERS, MPI_DOUBLE, MPI_SUM, ROOT_RANK, MPI_COMM_WORLD);
+		for(int c = 0; c < PERF_COUNTERS; c++)
+			if(available[c] == 0)
+				perf_totals[phase][c] = -1;
+	}
+	perf_counters.close();
+}
+
+// ROOT ONLY
+void print_perf_counters() {
+	const char* phase_names[3] = { "update", "halo", "draw" };
+	std::cout << std::endl << "Performance counters, summed over every process (per 1000 instructions):" << std::endl;
+	std::cout << std::setw(20) << "cycles" << std::setw(16) << "instructions" << std::setw(8) << "IPC"
+		<< std::setw(10) << "L1D miss" << std::setw(10) << "LLC miss" << std::setw(12) << "branch miss"
+		<< std::setw(14) << "cpu time (s)" << std::endl;
+
+	auto print_value = [](double value, int width, int precision) {
+		if(value < 0) std::cout << std::setw(width) << "-";
+		else std::cout << std::fixed << std::setprecision(precision) << std::setw(width) << value;
+	};
+	for(int phase = 0; phase < 3; phase++) {
+		const double* totals = perf_totals[phase];
+		double kilo_instructions = totals[PERF_INSTRUCTIONS] / 1000;
+		auto per_kilo_instruction = [&](int counter) {
+			return totals[counter] < 0 || kilo_instructions <= 0 ? -1 : totals[counter] / kilo_instructions;
+		};
+		std::cout << std::left << std::setw(8) << phase_names[phase] << std::right;
+		print_value(totals[PERF_CYCLES], 12, 0);
+		print_value(totals[PERF_INSTRUCTIONS], 16, 0);
+		print_value(totals[PERF_CYCLES] > 0 && totals[PERF_INSTRUCTIONS] >= 0 ? totals[PERF_INSTRUCTIONS] / totals[PERF_CYCLES] : -1, 8, 2);
+		print_value(per_kilo_instruction(PERF_L1D_MISSES), 10, 2);
+		print_value(per_kilo_instruction(PERF_LLC_MISSES), 10, 2);
+		print_value(per_kilo_instruction(PERF_BRANCH_MISSES), 12, 2);
+		print_value(totals[PERF_TASK_CLOCK] < 0 ? -1 : totals[PERF_TASK_CLOCK] / 1e9, 14, 4);
+		std::cout << std::endl;
+	}
+	std::cout.unsetf(std::ios::floatfield);
+	std::cout << std::setprecision(6);
+}
+
+// COLLECTIVE, every process in MPI_COMM_WORLD is a track, the display process too
+void write_trace() {
+	if(!tracer.write(MPI_COMM_WORLD, cfg->trace_file_path, ROOT_RANK)) {
+		std::cout << "Failed to write the trace to " << cfg->trace_file_path << std::endl;
+		return;
+	}
+
+	long long dropped = tracer.dropped_events();
+	MPI_Reduce(my_rank == ROOT_RANK ? MPI_IN_PLACE : &dropped, &dropped, 1, MPI_LONG_LONG, MPI_SUM, ROOT_RANK, MPI_COMM_WORLD);
+	if(my_rank == ROOT_RANK) {
+		std::cout << "Trace written to " << cfg->trace_file_path << std::endl;
+		if(dropped > 0)
+			std::cout << dropped << " events didn't fit in the trace buffers and were dropped" << std::endl;
+	}
+}
+
 void end_recap() {
+	summarize_latencies();
+	summarize_balance();
+	summarize_perf_counters();
 	if(my_rank != ROOT_RANK) return;
+	summarize_throughput();
 
 	std::cout << std::endl;
 	std::cout << "Communication time: " << communication_time << " s" << std::endl;
 	std::cout << "Generation time:    " << generation_time << " s" << std::endl;
 	std::cout << "Draw time:          " << draw_time << " s" << std::endl;
 	std::cout << "Total time:         " << total_time << " s" << std::endl;
+	if(!cfg->save_file_path.empty())
+		std::cout << "Save time:          " << save_time << " s" << std::endl;
+	if(cfg->checkpoint_interval > 0)
+		std::cout << "Checkpoint time:    " << checkpoint_time << " s" << std::endl;
+	if(!cfg->record_path.empty())
+		std::cout << "Record time:        " << record_time << " s" << std::endl;
+
+	if(update_latency.size() > 0) {
+		std::cout << std::endl << "Time per generation (ms), slowest process:" << std::endl;
+		std::cout << std::setw(22) << "min" << std::setw(10) << "p50" << std::setw(10) << "p95"
+			<< std::setw(10) << "p99" << std::setw(10) << "max" << std::endl;
+		if(cfg->is_parallel)
+			print_latency_summary("halo", halo_summary);
+		print_latency_summary("update", update_summary);
+		print_latency_summary("generation", generation_summary);
+	}
+
+	if(cfg->is_parallel) {
+		std::cout << std::endl << "Time across processes (s):" << std::endl;
+		std::cout << std::setw(25) << "min" << std::setw(10) << "avg" << std::setw(10) << "max"
+			<< std::setw(10) << "max rank" << std::setw(11) << "imbalance" << std::endl;
+		print_phase_balance("communication", communication_balance);
+		print_phase_balance("generation", generation_balance);
+		print_phase_balance("draw", draw_balance);
+		std::cout << std::endl;
+		print_process_table();
+	}
+
+	std::cout << std::endl;
+	std::cout << "Cell updates:       " << cell_updates_per_second << " /s, "
+		<< cell_updates_per_second / n_procs << " /s per process" << std::endl;
+	if(cfg->is_parallel)
+		std::cout << "Halo exchange:      " << halo_bytes << " B, " << halo_bytes_per_second << " B/s while exchanging" << std::endl;
+	if(speedup > 0)
+		std::cout << "Speedup:            " << speedup << " (efficiency " << efficiency << ") against the serial run in the results file" << std::endl;
+	std::cout << "Peak memory:        " << peak_rss_balance.max / 1024 << " MB on rank " << peak_rss_balance.max_rank
+		<< ", " << peak_rss_balance.avg / 1024 << " MB on average" << std::endl;
+	if(cfg->perf_counters)
+		print_perf_counters();
 
 	if(cfg->results_file_path.empty()) {
 		std::cout << "No results file path specified" << std::endl;
@@ -933,11 +3306,11 @@ void get_arg_configs(int argc, char const* argv[]) {
 	for(int i = 0; i < argc; i++) {
 		if(argv[i] == std::string("-h") || argv[i] == std::string("--help")) {
 			print_help();
-			exit();
+			exit_after_help();
 		}
 		if(argv[i] == std::string("-hc") || argv[i] == std::string("--help-config")) {
 			print_config_help();
-			exit();
+			exit_after_help();
 		}
 		else if(argv[i] == std::string("-g") || argv[i] == std::string("--graphic")) {
 			cfg->show_graphics = true;
@@ -975,6 +3348,76 @@ void get_arg_configs(int argc, char const* argv[]) {
 		else if(argv[i] == std::string("-fill") && i + 1 < argc) {
 			cfg->initial_fill_perc = std::stoi(argv[++i]);
 		}
+		else if(argv[i] == std::string("-R") || argv[i] == std::string("--render-rank")) {
+			cfg->render_rank = true;
+		}
+		else if(argv[i] == std::string("-gpf") && i + 1 < argc) {
+			cfg->generations_per_frame = std::stoi(argv[++i]);
+		}
+		else if(argv[i] == std::string("-lod") && i + 1 < argc) {
+			cfg->lod = std::stoi(argv[++i]);
+		}
+		else if(argv[i] == std::string("-record") && i + 1 < argc) {
+			cfg->record_path = argv[++i];
+		}
+		else if(argv[i] == std::string("-record-format") && i + 1 < argc) {
+			cfg->record_format = argv[++i];
+		}
+		else if(argv[i] == std::string("--perf-counters")) {
+			cfg->perf_counters = true;
+		}
+		else if(argv[i] == std::string("-trace") && i + 1 < argc) {
+			cfg->trace_file_path = argv[++i];
+		}
+		else if(argv[i] == std::string("--auto-decompose")) {
+			cfg->auto_decompose = true;
+		}
+		else if(argv[i] == std::string("-decompose-cache") && i + 1 < argc) {
+			cfg->decompose_cache_path = argv[++i];
+		}
+		else if(argv[i] == std::string("--bench")) {
+			cfg->bench = true;
+		}
+		else if(argv[i] == std::string("--bench-halo")) {
+			cfg->bench = true;
+			cfg->bench_halo_only = true;
+		}
+		else if(argv[i] == std::string("-bench-mode") && i + 1 < argc) {
+			cfg->bench_mode = argv[++i];
+		}
+		else if(argv[i] == std::string("-bench-trials") && i + 1 < argc) {
+			cfg->bench_trials = std::stoi(argv[++i]);
+		}
+		else if(argv[i] == std::string("-bench-file") && i + 1 < argc) {
+			cfg->bench_file_path = argv[++i];
+		}
+		else if(argv[i] == std::string("-mpi-profile") && i + 1 < argc) {
+			cfg->mpi_profile_file_path = argv[++i];
+		}
+		else if(argv[i] == std::string("-history") && i + 1 < argc) {
+			cfg->history_memory = std::stoi(argv[++i]);
+		}
+		else if(argv[i] == std::string("-keyframe-every") && i + 1 < argc) {
+			cfg->record_keyframe_interval = std::stoi(argv[++i]);
+		}
+		else if(argv[i] == std::string("-record-every") && i + 1 < argc) {
+			cfg->record_interval = std::stoi(argv[++i]);
+		}
+		else if(argv[i] == std::string("-checkpoint") && i + 1 < argc) {
+			cfg->checkpoint_interval = std::stoi(argv[++i]);
+		}
+		else if(argv[i] == std::string("--restart")) {
+			cfg->restart = true;
+		}
+		else if(argv[i] == std::string("-load") && i + 1 < argc) {
+			cfg->load_file_path = argv[++i];
+		}
+		else if(argv[i] == std::string("-save") && i + 1 < argc) {
+			cfg->save_file_path = argv[++i];
+		}
+		else if(argv[i] == std::string("-save-format") && i + 1 < argc) {
+			cfg->save_format = argv[++i];
+		}
 	}
 }
 
@@ -997,7 +3440,46 @@ void print_help() {
 		<< "-radius <int>: Neighbourhood radius" << std::endl
 		<< "-roughness <int>: Roughness" << std::endl
 		<< "-fill <int>: Initial fill percentage" << std::endl
+		<< "-lod <int>: Show one cell every <int>x<int> block, 0 picks it automatically" << std::endl
+		<< "-gpf <int>: Generations run between two frames, 0 runs as many as fit in a frame" << std::endl
+		<< "-history <int>: MB of memory for the frames kept to be shown again, 0 keeps none" << std::endl
+		<< "-R, --render-rank: Use one extra process only to show the grid (needs x*y+1 processes and graphics, can't record)" << std::endl
+		<< "-load <path>: Start from a raw, pgm or pbm file instead of a random grid, its size replaces cols and rows" << std::endl
+		<< "-save <path>: Save the last generation to a file" << std::endl
+		<< "-save-format <raw|pgm|pbm|png>: Format of the saved file" << std::endl
+		<< "-record <path>: Record the generations to a gif or cave file, or a folder of pgm/png frames" << std::endl
+		<< "-record-format <gif|cave|pgm|png>: Format of the recording" << std::endl
+		<< "-record-every <int>: Record one generation every <int>" << std::endl
+		<< "-keyframe-every <int>: Frames between two keyframes of a cave recording" << std::endl
+		<< "-play <path>: Play back a cave recording, no mpirun needed" << std::endl
+		<< "-checkpoint <int>: Write a checkpoint every <int> generations" << std::endl
+		<< "--restart: Resume from the newest checkpoint, x and y may differ from the run that wrote it" << std::endl
 		<< "-o <path>: Path to results file" << std::endl
+		<< "-trace <path>: Write a timeline of every process, open it in chrome://tracing or ui.perfetto.dev" << std::endl
+		<< "--auto-decompose: Pick x and y by timing every layout of the processes, the choice is cached per grid, radius and host" << std::endl
+		<< "-decompose-cache <path>: File the layouts picked by --auto-decompose are cached in" << std::endl
+		<< "--bench: Time every layout of up to all the processes instead of running the cave, see bench_* in the config help" << std::endl
+		<< "--bench-halo: Like --bench, timing only the halo exchange, without updating the cells" << std::endl
+		<< "-bench-mode <strong|weak>: Same grid on every layout, or the same tile on every process" << std::endl
+		<< "-bench-trials <int>: Timed trials of every case" << std::endl
+		<< "-bench-file <path>: CSV the trials are written to" << std::endl
+		<< "-mpi-profile <path>: Count messages, bytes and time blocked in MPI per peer and direction, written at exit" << std::endl
+		<< "--perf-counters: Count cycles, instructions, cache and branch misses of update, halo and draw (linux perf_event_open)" << std::endl
+		<< std::endl
+		<< "When the grid is shown with a lower level of detail:" << std::endl
+		<< "arrows/WASD or mouse drag: move the view" << std::endl
+		<< "+/- or mouse wheel: zoom in and out, down to full resolution" << std::endl
+		<< "0/home: show the whole grid" << std::endl
+		<< std::endl
+		<< "p/space: pause and resume" << std::endl
+		<< "comma/period: one frame back and forth, forward from the newest frame runs one generation" << std::endl
+		<< "page up/down: " << HISTORY_PAGE_FRAMES << " frames back and forth" << std::endl
+		<< "end: back to the newest frame" << std::endl
+		<< std::endl
+		<< "When playing back a recording:" << std::endl
+		<< "space: pause and resume" << std::endl
+		<< "left/right: step one frame back and forth" << std::endl
+		<< "home/end: jump to the first and last frame" << std::endl
 		<< std::endl
 		<< "Example: " << std::endl
 		<< "mpirun -np 6 ./cavegen -c custom-config.cfg -p -g -x 3 -y 2" << std::endl
@@ -1024,6 +3506,33 @@ void print_config_help() {
 		<< "x_threads: <int>" << std::endl
 		<< "y_threads: <int>" << std::endl
 		<< "results_file_path: <string>" << std::endl
+		<< "latency_samples: <int>, latest generations the latency percentiles are taken from (default 65536)" << std::endl
+		<< "trace_file_path: <string>, chrome trace of every process written at exit" << std::endl
+		<< "perf_counters: <bool>, hardware counters of update, halo and draw in the recap and results file" << std::endl
+		<< "mpi_profile_file_path: <string>, traffic matrices and time blocked in MPI written at exit" << std::endl
+		<< "auto_decompose: <bool>, pick x_threads and y_threads by timing every layout, they are ignored" << std::endl
+		<< "auto_decompose_generations: <int>, generations in every trial of a layout" << std::endl
+		<< "decompose_cache_path: <string>, json file the picked layouts are cached in" << std::endl
+		<< "bench_mode: \"strong\" (fixed grid) or \"weak\" (fixed tile per process)" << std::endl
+		<< "bench_sizes: [[<int>, <int>], ...], cols and rows of the benchmarked grids, the tile in weak mode" << std::endl
+		<< "bench_radii: [<int>, ...], neighbour radii to benchmark" << std::endl
+		<< "bench_halo_only: <bool>, time only the halo exchange, reports its latency and bandwidth" << std::endl
+		<< "bench_max_procs: <int>, layouts use up to this many processes, 0 for all of them" << std::endl
+		<< "bench_warmup_generations: <int>, untimed generations before the trials of every case" << std::endl
+		<< "bench_trials: <int>, timed trials of every case" << std::endl
+		<< "bench_generations: <int>, generations in every trial" << std::endl
+		<< "bench_file_path: <string>, CSV with a row per trial" << std::endl
+		<< "load_file_path: <string>, raw, pgm or pbm file the first generation is loaded from" << std::endl
+		<< "save_file_path: <string>, the last generation is saved here" << std::endl
+		<< "save_format: \"raw\", \"pgm\", \"pbm\" (bit-packed) or \"png\"" << std::endl
+		<< "record_path: <string>, gif or cave file, or folder of frames the generations are recorded to" << std::endl
+		<< "record_format: \"gif\", \"cave\", \"pgm\" or \"png\", cave stores bit-packed keyframes and run-length coded deltas, shown with -play" << std::endl
+		<< "record_keyframe_interval: <int>, frames between two keyframes of a cave recording" << std::endl
+		<< "record_interval: <int>, one generation every <int> is recorded" << std::endl
+		<< "checkpoint_interval: <int>, generations between two checkpoints, 0 writes none" << std::endl
+		<< "checkpoint_file_path: <string>, checkpoints are written in turns to <string>.0 and <string>.1" << std::endl
+		<< "checkpoint_compress: <bool>, bit-pack the checkpointed grid" << std::endl
+		<< "restart: <bool>, resume from the newest checkpoint" << std::endl
 		<< "roughness: <int>" << std::endl
 		<< "neighbour_radius: <int>" << std::endl
 		<< "initial_fill_perc: <int>" << std::endl
@@ -1032,12 +3541,33 @@ void print_config_help() {
 		<< "cell_height: <int>" << std::endl
 		<< "draw_edges: <bool>" << std::endl
 		<< "draw_threads_grid: <bool>" << std::endl
+		<< "max_frame_rate: <int>" << std::endl
+		<< "generations_per_frame: <int>, 0 runs as many as fit in a frame" << std::endl
+		<< "render_rank: <bool>, one extra process only shows the grid" << std::endl
+		<< "lod: <int>, 0 picks the level of detail automatically" << std::endl
+		<< "lod_mode: \"majority\" or \"density\"" << std::endl
+		<< "history_memory: <int>, MB of memory for the frames kept to be shown again while paused" << std::endl
 		<< "wall_color: [r, g, b], where r,g,b are int between 0-255" << std::endl
 		<< "floor_color: [r, g, b], where r,g,b are int between 0-255" << std::endl
 		<< "threads_grid_color: [r, g, b], where r,g,b are int between 0-255" << std::endl;
 }
 
+// playback runs without MPI
+inline bool is_mpi_initialized() {
+	int is_initialized;
+	MPI_Initialized(&is_initialized);
+	return is_initialized;
+}
+
 inline void exit() {
-	MPI_Abort(MPI_COMM_WORLD, 1);
+	if(is_mpi_initialized())
+		MPI_Abort(MPI_COMM_WORLD, 1);
 	exit(1);
 }
+
+// every process read the same arguments, so they all get here
+inline void exit_after_help() {
+	if(is_mpi_initialized())
+		MPI_Finalize();
+	exit(0);
+}